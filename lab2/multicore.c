@@ -0,0 +1,491 @@
+#include "multicore.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_CPU UINT32_MAX
+
+static const char *const balance_names[] = {
+  [BALANCE_GLOBAL] = "global",
+  [BALANCE_STEAL] = "steal",
+};
+
+bool balance_parse(const char *name, enum balance *balance)
+{
+  for (u32 i = 0; i < sizeof(balance_names) / sizeof(balance_names[0]); ++i)
+  {
+    if (strcmp(name, balance_names[i]) == 0)
+    {
+      *balance = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* A policy's run queue and how many processes are waiting in it */
+struct run_queue
+{
+  void *state;
+  u32 ready;
+};
+
+struct cpu
+{
+  struct run_queue local;  /* unused with BALANCE_GLOBAL */
+  struct run_queue pinned; /* processes with an affinity for this CPU */
+  struct process *running;
+  struct process *stopped; /* stopped at this event, requeued after the arrivals */
+  u64 slice_start;
+  u64 slice_end;
+  u32 heap_index; /* position in machine.running while running */
+  struct cpu_stats stats;
+};
+
+/* Each event only visits the CPUs it involves: running CPUs sit in a heap
+   ordered by when their slice ends, and bitmaps track which CPUs are idle
+   and which were stopped or given work at this event. Ties between CPUs
+   always go to the lowest numbered one. */
+struct machine
+{
+  const struct policy *policy;
+  enum balance balance;
+  u32 cpu_count;
+  struct cpu *cpus;
+  struct run_queue global; /* unused with BALANCE_STEAL */
+  u32 shared_ready;        /* processes waiting that any CPU may run */
+
+  u32 *running; /* min-heap of running CPUs by (slice_end, index) */
+  u32 running_count;
+  u64 *idle;
+  u64 *touched;
+  u32 words; /* in each bitmap */
+  bool poke_all; /* an arrival at this event was queued for every CPU */
+
+  u64 total_waiting_time;
+  u64 total_response_time;
+  u64 end_time;
+  u32 completed;
+};
+
+static void set_bit(u64 *bits, u32 i)
+{
+  bits[i / 64] |= 1ull << (i % 64);
+}
+
+static void clear_bit(u64 *bits, u32 i)
+{
+  bits[i / 64] &= ~(1ull << (i % 64));
+}
+
+/* The first idle CPU from `from` on that may have something to pick: any
+   idle CPU while shared work is waiting, and otherwise only those touched
+   at this event, since an idle CPU picks up its own work as soon as it gets
+   it */
+static u32 next_candidate(const struct machine *machine, u32 from)
+{
+  for (u32 word = from / 64; word < machine->words; ++word)
+  {
+    u64 bits = machine->idle[word];
+    if (machine->shared_ready == 0)
+    {
+      bits &= machine->touched[word];
+    }
+    if (word == from / 64)
+    {
+      bits &= ~0ull << (from % 64);
+    }
+    if (bits != 0)
+    {
+      return word * 64 + __builtin_ctzll(bits);
+    }
+  }
+  return NO_CPU;
+}
+
+static bool cpu_before(const struct machine *machine, u32 a, u32 b)
+{
+  u64 a_end = machine->cpus[a].slice_end;
+  u64 b_end = machine->cpus[b].slice_end;
+  return a_end != b_end ? a_end < b_end : a < b;
+}
+
+static void running_place(struct machine *machine, u32 position, u32 cpu)
+{
+  machine->running[position] = cpu;
+  machine->cpus[cpu].heap_index = position;
+}
+
+static void running_sift(struct machine *machine, u32 position)
+{
+  u32 cpu = machine->running[position];
+  while (position > 0)
+  {
+    u32 parent = (position - 1) / 2;
+    if (!cpu_before(machine, cpu, machine->running[parent]))
+    {
+      break;
+    }
+    running_place(machine, position, machine->running[parent]);
+    position = parent;
+  }
+  for (;;)
+  {
+    u32 child = 2 * position + 1;
+    if (child >= machine->running_count)
+    {
+      break;
+    }
+    if (child + 1 < machine->running_count &&
+        cpu_before(machine, machine->running[child + 1], machine->running[child]))
+    {
+      ++child;
+    }
+    if (!cpu_before(machine, machine->running[child], cpu))
+    {
+      break;
+    }
+    running_place(machine, position, machine->running[child]);
+    position = child;
+  }
+  running_place(machine, position, cpu);
+}
+
+static void running_remove(struct machine *machine, u32 cpu)
+{
+  u32 position = machine->cpus[cpu].heap_index;
+  u32 last = machine->running[--machine->running_count];
+  if (last != cpu)
+  {
+    running_place(machine, position, last);
+    running_sift(machine, position);
+  }
+}
+
+/* The queue proc waits in between runs on cpu, and whose policy state it
+   is accounted to while running there */
+static struct run_queue *home_queue(struct machine *machine, u32 cpu, const struct process *proc)
+{
+  if (proc->affinity != NO_AFFINITY)
+  {
+    return &machine->cpus[proc->affinity].pinned;
+  }
+  if (machine->balance == BALANCE_GLOBAL)
+  {
+    return &machine->global;
+  }
+  return &machine->cpus[cpu].local;
+}
+
+static void push(struct machine *machine, u32 cpu, struct process *proc, bool arrival)
+{
+  struct run_queue *queue = home_queue(machine, cpu, proc);
+  if (arrival)
+  {
+    machine->policy->enqueue(queue->state, proc);
+  }
+  else
+  {
+    machine->policy->on_preempt(queue->state, proc);
+  }
+  ++queue->ready;
+  if (proc->affinity == NO_AFFINITY)
+  {
+    ++machine->shared_ready;
+  }
+}
+
+static u32 load(const struct cpu *cpu)
+{
+  return cpu->local.ready + cpu->pinned.ready + (cpu->running != NULL || cpu->stopped != NULL);
+}
+
+static void admit(struct machine *machine, struct process *proc)
+{
+  u32 target = 0;
+  if (proc->affinity != NO_AFFINITY)
+  {
+    target = proc->affinity;
+  }
+  else if (machine->balance == BALANCE_GLOBAL)
+  {
+    /* Any CPU may be the one to pick it up */
+    push(machine, 0, proc, true);
+    machine->poke_all = true;
+    return;
+  }
+  else
+  {
+    for (u32 i = 1; i < machine->cpu_count; ++i)
+    {
+      if (load(&machine->cpus[i]) < load(&machine->cpus[target]))
+      {
+        target = i;
+      }
+    }
+  }
+  push(machine, target, proc, true);
+  set_bit(machine->touched, target);
+}
+
+/* Stops cpu's running process at now, and completes it if it is done */
+static void stop(struct machine *machine, u32 cpu_index, u64 now)
+{
+  struct cpu *cpu = &machine->cpus[cpu_index];
+  struct process *proc = cpu->running;
+  u32 ran = now - cpu->slice_start;
+  proc->remaining_time -= ran;
+  cpu->stats.busy_time += ran;
+  machine->policy->on_tick(home_queue(machine, cpu_index, proc)->state, proc, ran, now);
+  cpu->running = NULL;
+  running_remove(machine, cpu_index);
+  set_bit(machine->idle, cpu_index);
+  set_bit(machine->touched, cpu_index);
+
+  if (proc->remaining_time == 0)
+  {
+    machine->total_waiting_time += now - proc->arrival_time - proc->burst_time;
+    machine->end_time = now;
+    ++machine->completed;
+  }
+  else
+  {
+    cpu->stopped = proc;
+  }
+}
+
+/* Gives an idle cpu its next process: its pinned work first, then the
+   shared or local queue, and failing those, if allowed, a steal from the
+   CPU with the longest local queue */
+static void pick(struct machine *machine, u32 cpu_index, u64 now, bool steal)
+{
+  struct cpu *cpu = &machine->cpus[cpu_index];
+  struct run_queue *queue = NULL;
+  if (cpu->pinned.ready > 0)
+  {
+    queue = &cpu->pinned;
+  }
+  else if (machine->shared_ready == 0)
+  {
+    return;
+  }
+  else if (machine->balance == BALANCE_GLOBAL)
+  {
+    queue = &machine->global;
+  }
+  else if (cpu->local.ready > 0)
+  {
+    queue = &cpu->local;
+  }
+  else if (!steal)
+  {
+    return;
+  }
+  else
+  {
+    for (u32 i = 0; i < machine->cpu_count; ++i)
+    {
+      struct run_queue *victim = &machine->cpus[i].local;
+      if (victim->ready > 0 && (queue == NULL || victim->ready > queue->ready))
+      {
+        queue = victim;
+      }
+    }
+  }
+
+  struct process *proc = machine->policy->pick_next(queue->state);
+  --queue->ready;
+  if (proc->affinity == NO_AFFINITY)
+  {
+    --machine->shared_ready;
+  }
+
+  if (!proc->responded)
+  {
+    proc->responded = true;
+    machine->total_response_time += now - proc->arrival_time;
+  }
+  if (proc->last_cpu != NO_CPU && proc->last_cpu != cpu_index)
+  {
+    ++cpu->stats.migrations;
+  }
+  proc->last_cpu = cpu_index;
+
+  /* A stolen process runs and is requeued under this CPU's policy state */
+  struct run_queue *home = home_queue(machine, cpu_index, proc);
+  if (home != queue && machine->policy->migrate != NULL)
+  {
+    machine->policy->migrate(queue->state, home->state, proc);
+  }
+
+  u32 run_time = machine->policy->time_slice(home->state, proc);
+  if (proc->remaining_time < run_time)
+  {
+    run_time = proc->remaining_time;
+  }
+  cpu->running = proc;
+  cpu->slice_start = now;
+  cpu->slice_end = now + run_time;
+  clear_bit(machine->idle, cpu_index);
+  running_place(machine, machine->running_count++, cpu_index);
+  running_sift(machine, machine->running_count - 1);
+}
+
+static void *checked_calloc(size_t count, size_t size)
+{
+  void *ptr = calloc(count, size);
+  if (ptr == NULL)
+  {
+    int err = errno;
+    perror("calloc");
+    exit(err);
+  }
+  return ptr;
+}
+
+void simulate_multicore(const struct policy *policy,
+                        enum balance balance,
+                        u32 cpu_count,
+                        struct process *data,
+                        u32 size,
+                        u32 quantum_length,
+                        u64 *total_waiting_time,
+                        u64 *total_response_time,
+                        u64 *end_time,
+                        struct cpu_stats *cpu_stats)
+{
+  for (u32 i = 0; i < size; ++i)
+  {
+    data[i].remaining_time = data[i].burst_time;
+    data[i].responded = false;
+    data[i].last_cpu = NO_CPU;
+  }
+
+  struct machine machine = {
+    .policy = policy,
+    .balance = balance,
+    .cpu_count = cpu_count,
+    .words = (cpu_count + 63) / 64,
+  };
+  machine.cpus = checked_calloc(cpu_count, sizeof(struct cpu));
+  machine.running = checked_calloc(cpu_count, sizeof(u32));
+  machine.idle = checked_calloc(machine.words, sizeof(u64));
+  machine.touched = checked_calloc(machine.words, sizeof(u64));
+  if (balance == BALANCE_GLOBAL)
+  {
+    machine.global.state = policy->create(quantum_length, size);
+  }
+  for (u32 i = 0; i < cpu_count; ++i)
+  {
+    if (balance == BALANCE_STEAL)
+    {
+      machine.cpus[i].local.state = policy->create(quantum_length, size / cpu_count);
+    }
+    machine.cpus[i].pinned.state = policy->create(quantum_length, 0);
+    set_bit(machine.idle, i);
+  }
+
+  /* Each iteration advances to the next event: an arrival, or the end of
+     some CPU's time slice. The same order as the single CPU simulation
+     holds at every event: slices end, arrivals are queued, preempted
+     processes are requeued behind them, and then idle CPUs pick. */
+  u32 next_arrival = 0;
+  while (machine.completed < size)
+  {
+    u64 now = next_arrival < size ? data[next_arrival].arrival_time : UINT64_MAX;
+    if (machine.running_count > 0 && machine.cpus[machine.running[0]].slice_end < now)
+    {
+      now = machine.cpus[machine.running[0]].slice_end;
+    }
+
+    while (machine.running_count > 0 && machine.cpus[machine.running[0]].slice_end == now)
+    {
+      stop(&machine, machine.running[0], now);
+    }
+
+    while (next_arrival < size && data[next_arrival].arrival_time <= now)
+    {
+      admit(&machine, &data[next_arrival]);
+      ++next_arrival;
+    }
+
+    /* Preemptive policies reconsider every CPU an arrival was queued for */
+    if (policy->preempt_on_arrival && machine.poke_all)
+    {
+      for (u32 i = 0; i < cpu_count; ++i)
+      {
+        if (machine.cpus[i].running != NULL)
+        {
+          stop(&machine, i, now);
+        }
+      }
+    }
+    else if (policy->preempt_on_arrival)
+    {
+      for (u32 word = 0; word < machine.words; ++word)
+      {
+        for (u64 bits = machine.touched[word] & ~machine.idle[word]; bits != 0; bits &= bits - 1)
+        {
+          stop(&machine, word * 64 + __builtin_ctzll(bits), now);
+        }
+      }
+    }
+    machine.poke_all = false;
+
+    for (u32 word = 0; word < machine.words; ++word)
+    {
+      for (u64 bits = machine.touched[word]; bits != 0; bits &= bits - 1)
+      {
+        u32 i = word * 64 + __builtin_ctzll(bits);
+        if (machine.cpus[i].stopped != NULL)
+        {
+          push(&machine, i, machine.cpus[i].stopped, false);
+          machine.cpus[i].stopped = NULL;
+        }
+      }
+    }
+
+    /* With per-CPU queues, CPUs run their own work before anyone steals it */
+    if (balance == BALANCE_STEAL)
+    {
+      for (u32 word = 0; word < machine.words; ++word)
+      {
+        for (u64 bits = machine.touched[word] & machine.idle[word]; bits != 0; bits &= bits - 1)
+        {
+          pick(&machine, word * 64 + __builtin_ctzll(bits), now, false);
+        }
+      }
+    }
+    for (u32 i = next_candidate(&machine, 0); i != NO_CPU; i = next_candidate(&machine, i + 1))
+    {
+      pick(&machine, i, now, true);
+    }
+    memset(machine.touched, 0, sizeof(u64) * machine.words);
+  }
+
+  *total_waiting_time += machine.total_waiting_time;
+  *total_response_time += machine.total_response_time;
+  *end_time = machine.end_time;
+  for (u32 i = 0; i < cpu_count; ++i)
+  {
+    if (cpu_stats != NULL)
+    {
+      cpu_stats[i] = machine.cpus[i].stats;
+    }
+    if (balance == BALANCE_STEAL)
+    {
+      policy->destroy(machine.cpus[i].local.state);
+    }
+    policy->destroy(machine.cpus[i].pinned.state);
+  }
+  if (balance == BALANCE_GLOBAL)
+  {
+    policy->destroy(machine.global.state);
+  }
+  free(machine.touched);
+  free(machine.idle);
+  free(machine.running);
+  free(machine.cpus);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "policy.h"
+
+/* How the CPUs share work. global: one run queue that every CPU picks
+   from. steal: a run queue per CPU, where an arrival goes to the least
+   loaded CPU, a preempted process stays put, and a CPU with nothing to run
+   takes the next process from the CPU with the most waiting. */
+enum balance
+{
+  BALANCE_GLOBAL,
+  BALANCE_STEAL,
+};
+
+bool balance_parse(const char *name, enum balance *balance);
+
+struct cpu_stats
+{
+  u64 busy_time;  /* time spent running processes */
+  u64 migrations; /* times a process ran here after last running elsewhere */
+};
+
+/* Like simulate, on cpu_count CPUs. Processes with an affinity are only
+   run by that CPU, which runs them ahead of its other work and never has
+   them stolen. end_time is when the last process completed, and
+   cpu_stats, unless NULL, gets cpu_count entries. */
+void simulate_multicore(const struct policy *policy,
+                        enum balance balance,
+                        u32 cpu_count,
+                        struct process *data,
+                        u32 size,
+                        u32 quantum_length,
+                        u64 *total_waiting_time,
+                        u64 *total_response_time,
+                        u64 *end_time,
+                        struct cpu_stats *cpu_stats);
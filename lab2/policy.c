@@ -0,0 +1,462 @@
+#include "policy.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MLFQ_LEVELS 3
+#define MLFQ_BOOST_QUANTA 64 /* every process returns to the top queue this often */
+
+static void *checked_calloc(size_t count, size_t size)
+{
+  void *ptr = calloc(count ? count : 1, size);
+  if (ptr == NULL)
+  {
+    int err = errno;
+    perror("calloc");
+    exit(err);
+  }
+  return ptr;
+}
+
+/* Binary min-heap of processes, for the policies that order their run
+   queue by a key. Each entry carries its key and arrival order, so sifting
+   compares entries in the array instead of chasing process pointers. */
+struct heap_entry
+{
+  u64 key;
+  u32 order;
+  struct process *proc;
+};
+
+struct process_heap
+{
+  struct heap_entry *entries;
+  u32 size;
+  u32 capacity;
+  u64 (*key)(const struct process *proc);
+};
+
+static bool entry_before(const struct heap_entry *a, const struct heap_entry *b)
+{
+  if (a->key != b->key)
+  {
+    return a->key < b->key;
+  }
+  return a->order < b->order;
+}
+
+static struct process_heap *heap_create(u32 capacity, u64 (*key)(const struct process *))
+{
+  struct process_heap *heap = checked_calloc(1, sizeof(struct process_heap));
+  heap->capacity = capacity > 0 ? capacity : 16;
+  heap->entries = checked_calloc(heap->capacity, sizeof(struct heap_entry));
+  heap->key = key;
+  return heap;
+}
+
+static void heap_destroy(void *state)
+{
+  struct process_heap *heap = state;
+  free(heap->entries);
+  free(heap);
+}
+
+static void heap_push(void *state, struct process *proc)
+{
+  struct process_heap *heap = state;
+  if (heap->size == heap->capacity)
+  {
+    heap->capacity *= 2;
+    heap->entries = realloc(heap->entries, sizeof(struct heap_entry) * heap->capacity);
+    if (heap->entries == NULL)
+    {
+      int err = errno;
+      perror("realloc");
+      exit(err);
+    }
+  }
+  struct heap_entry entry = {heap->key(proc), proc->order, proc};
+  u32 i = heap->size++;
+  while (i > 0)
+  {
+    u32 parent = (i - 1) / 2;
+    if (!entry_before(&entry, &heap->entries[parent]))
+    {
+      break;
+    }
+    heap->entries[i] = heap->entries[parent];
+    i = parent;
+  }
+  heap->entries[i] = entry;
+}
+
+static struct process *heap_pop(void *state)
+{
+  struct process_heap *heap = state;
+  struct process *top = heap->entries[0].proc;
+  struct heap_entry last = heap->entries[--heap->size];
+  u32 i = 0;
+  for (;;)
+  {
+    u32 child = 2 * i + 1;
+    if (child >= heap->size)
+    {
+      break;
+    }
+    if (child + 1 < heap->size && entry_before(&heap->entries[child + 1], &heap->entries[child]))
+    {
+      ++child;
+    }
+    if (!entry_before(&heap->entries[child], &last))
+    {
+      break;
+    }
+    heap->entries[i] = heap->entries[child];
+    i = child;
+  }
+  if (heap->size > 0)
+  {
+    heap->entries[i] = last;
+  }
+  return top;
+}
+
+static u32 run_to_completion(void *state, const struct process *proc)
+{
+  (void)state;
+  (void)proc;
+  return POLICY_RUN_TO_COMPLETION;
+}
+
+static void no_tick(void *state, struct process *proc, u32 ran, u64 now)
+{
+  (void)state;
+  (void)proc;
+  (void)ran;
+  (void)now;
+}
+
+/* Round Robin and FCFS: a FIFO queue, where RR preempts every quantum */
+
+struct fifo
+{
+  struct process_list list;
+  u32 quantum;
+};
+
+static void *fifo_create(u32 quantum, u32 size)
+{
+  (void)size;
+  struct fifo *fifo = checked_calloc(1, sizeof(struct fifo));
+  TAILQ_INIT(&fifo->list);
+  fifo->quantum = quantum;
+  return fifo;
+}
+
+static void fifo_destroy(void *state)
+{
+  free(state);
+}
+
+static void fifo_enqueue(void *state, struct process *proc)
+{
+  struct fifo *fifo = state;
+  TAILQ_INSERT_TAIL(&fifo->list, proc, pointers);
+}
+
+static struct process *fifo_pick_next(void *state)
+{
+  struct fifo *fifo = state;
+  struct process *proc = TAILQ_FIRST(&fifo->list);
+  TAILQ_REMOVE(&fifo->list, proc, pointers);
+  return proc;
+}
+
+static u32 rr_time_slice(void *state, const struct process *proc)
+{
+  (void)proc;
+  return ((struct fifo *)state)->quantum;
+}
+
+/* SJF, SRTF and priority: a heap keyed by burst, remaining time or
+   priority, with earlier arrivals first among equals */
+
+static u64 burst_key(const struct process *proc)
+{
+  return proc->burst_time;
+}
+
+static u64 remaining_key(const struct process *proc)
+{
+  return proc->remaining_time;
+}
+
+static u64 priority_key(const struct process *proc)
+{
+  return proc->priority;
+}
+
+static void *sjf_create(u32 quantum, u32 size)
+{
+  (void)quantum;
+  return heap_create(size, burst_key);
+}
+
+static void *srtf_create(u32 quantum, u32 size)
+{
+  (void)quantum;
+  return heap_create(size, remaining_key);
+}
+
+static void *priority_create(u32 quantum, u32 size)
+{
+  (void)quantum;
+  return heap_create(size, priority_key);
+}
+
+/* CFS: run whoever has had the least CPU time (vruntime) for a quantum at
+   a time. A new arrival starts at the smallest vruntime in the queue, so it
+   does not get to monopolize the CPU catching up on time it was absent. */
+
+struct cfs
+{
+  struct process_heap *heap;
+  u32 quantum;
+  u64 min_vruntime; /* vruntime of the last process picked, never decreases */
+};
+
+static u64 vruntime_key(const struct process *proc)
+{
+  return proc->vruntime;
+}
+
+static void *cfs_create(u32 quantum, u32 size)
+{
+  struct cfs *cfs = checked_calloc(1, sizeof(struct cfs));
+  cfs->heap = heap_create(size, vruntime_key);
+  cfs->quantum = quantum;
+  return cfs;
+}
+
+static void cfs_destroy(void *state)
+{
+  struct cfs *cfs = state;
+  heap_destroy(cfs->heap);
+  free(cfs);
+}
+
+static void cfs_enqueue(void *state, struct process *proc)
+{
+  struct cfs *cfs = state;
+  proc->vruntime = cfs->min_vruntime;
+  heap_push(cfs->heap, proc);
+}
+
+static struct process *cfs_pick_next(void *state)
+{
+  struct cfs *cfs = state;
+  struct process *proc = heap_pop(cfs->heap);
+  /* The queue's least vruntime, which is a lower bound for proc's until it
+     runs again, and does not depend on when arrivals are enqueued */
+  if (proc->vruntime > cfs->min_vruntime)
+  {
+    cfs->min_vruntime = proc->vruntime;
+  }
+  return proc;
+}
+
+static u32 cfs_time_slice(void *state, const struct process *proc)
+{
+  (void)proc;
+  return ((struct cfs *)state)->quantum;
+}
+
+static void cfs_on_tick(void *state, struct process *proc, u32 ran, u64 now)
+{
+  (void)state;
+  (void)now;
+  proc->vruntime += ran;
+}
+
+static void cfs_on_preempt(void *state, struct process *proc)
+{
+  heap_push(((struct cfs *)state)->heap, proc);
+}
+
+/* Keeps proc's lead over the queue it left, measured from its new queue's
+   min_vruntime instead */
+static void cfs_migrate(void *from, void *to, struct process *proc)
+{
+  u64 from_min = ((struct cfs *)from)->min_vruntime;
+  u64 lead = proc->vruntime > from_min ? proc->vruntime - from_min : 0;
+  proc->vruntime = ((struct cfs *)to)->min_vruntime + lead;
+}
+
+/* MLFQ: MLFQ_LEVELS round-robin queues, each with twice the quantum of the
+   one above. Arrivals start at the top, a process that uses a whole quantum
+   moves down a level, and every MLFQ_BOOST_QUANTA quanta everyone moves
+   back to the top. A boost appends the lower queues to the top one and bumps
+   epoch, and a process's level is only reset when it is next looked at, so
+   a boost costs O(levels) however many processes are waiting. */
+
+struct mlfq
+{
+  struct process_list levels[MLFQ_LEVELS];
+  u32 quantum;
+  u32 epoch;
+  u64 next_boost;
+};
+
+static void *mlfq_create(u32 quantum, u32 size)
+{
+  (void)size;
+  struct mlfq *mlfq = checked_calloc(1, sizeof(struct mlfq));
+  for (u32 i = 0; i < MLFQ_LEVELS; ++i)
+  {
+    TAILQ_INIT(&mlfq->levels[i]);
+  }
+  mlfq->quantum = quantum;
+  mlfq->next_boost = (u64)quantum * MLFQ_BOOST_QUANTA;
+  return mlfq;
+}
+
+static void mlfq_destroy(void *state)
+{
+  free(state);
+}
+
+static u32 mlfq_level_quantum(const struct mlfq *mlfq, u32 level)
+{
+  return mlfq->quantum << level;
+}
+
+/* Applies any boost since proc's level was last set; returns whether one happened */
+static bool mlfq_refresh(const struct mlfq *mlfq, struct process *proc)
+{
+  if (proc->epoch == mlfq->epoch)
+  {
+    return false;
+  }
+  proc->epoch = mlfq->epoch;
+  proc->level = 0;
+  proc->slice_used = 0;
+  return true;
+}
+
+static void mlfq_enqueue(void *state, struct process *proc)
+{
+  struct mlfq *mlfq = state;
+  proc->epoch = mlfq->epoch;
+  proc->level = 0;
+  proc->slice_used = 0;
+  TAILQ_INSERT_TAIL(&mlfq->levels[0], proc, pointers);
+}
+
+static struct process *mlfq_pick_next(void *state)
+{
+  struct mlfq *mlfq = state;
+  for (u32 i = 0; i < MLFQ_LEVELS; ++i)
+  {
+    struct process *proc = TAILQ_FIRST(&mlfq->levels[i]);
+    if (proc != NULL)
+    {
+      TAILQ_REMOVE(&mlfq->levels[i], proc, pointers);
+      mlfq_refresh(mlfq, proc);
+      return proc;
+    }
+  }
+  return NULL;
+}
+
+static u32 mlfq_time_slice(void *state, const struct process *proc)
+{
+  struct mlfq *mlfq = state;
+  return mlfq_level_quantum(mlfq, proc->level) - proc->slice_used;
+}
+
+static void mlfq_on_tick(void *state, struct process *proc, u32 ran, u64 now)
+{
+  struct mlfq *mlfq = state;
+  proc->slice_used += ran;
+  if (now < mlfq->next_boost)
+  {
+    return;
+  }
+  for (u32 i = 1; i < MLFQ_LEVELS; ++i)
+  {
+    TAILQ_CONCAT(&mlfq->levels[0], &mlfq->levels[i], pointers);
+  }
+  ++mlfq->epoch;
+  u64 interval = (u64)mlfq->quantum * MLFQ_BOOST_QUANTA;
+  mlfq->next_boost = now - now % interval + interval;
+}
+
+static void mlfq_on_preempt(void *state, struct process *proc)
+{
+  struct mlfq *mlfq = state;
+  if (mlfq_refresh(mlfq, proc))
+  {
+    /* boosted while running: a fresh start behind the others at the top */
+    TAILQ_INSERT_TAIL(&mlfq->levels[0], proc, pointers);
+  }
+  else if (proc->slice_used >= mlfq_level_quantum(mlfq, proc->level))
+  {
+    if (proc->level + 1 < MLFQ_LEVELS)
+    {
+      ++proc->level;
+    }
+    proc->slice_used = 0;
+    TAILQ_INSERT_TAIL(&mlfq->levels[proc->level], proc, pointers);
+  }
+  else
+  {
+    /* cut short by an arrival: resume ahead of its level */
+    TAILQ_INSERT_HEAD(&mlfq->levels[proc->level], proc, pointers);
+  }
+}
+
+/* pick_next has already applied any boost of the queue proc left; its level
+   stands, and is only reset by the new queue's boosts from now on */
+static void mlfq_migrate(void *from, void *to, struct process *proc)
+{
+  (void)from;
+  proc->epoch = ((struct mlfq *)to)->epoch;
+}
+
+static const struct policy policies[] = {
+  {"rr", false, fifo_create, fifo_destroy, fifo_enqueue, fifo_pick_next,
+   rr_time_slice, no_tick, fifo_enqueue},
+  {"fcfs", false, fifo_create, fifo_destroy, fifo_enqueue, fifo_pick_next,
+   run_to_completion, no_tick, fifo_enqueue},
+  {"sjf", false, sjf_create, heap_destroy, heap_push, heap_pop,
+   run_to_completion, no_tick, heap_push},
+  {"srtf", true, srtf_create, heap_destroy, heap_push, heap_pop,
+   run_to_completion, no_tick, heap_push},
+  {"priority", true, priority_create, heap_destroy, heap_push, heap_pop,
+   run_to_completion, no_tick, heap_push},
+  {"mlfq", true, mlfq_create, mlfq_destroy, mlfq_enqueue, mlfq_pick_next,
+   mlfq_time_slice, mlfq_on_tick, mlfq_on_preempt, mlfq_migrate},
+  {"cfs", false, cfs_create, cfs_destroy, cfs_enqueue, cfs_pick_next,
+   cfs_time_slice, cfs_on_tick, cfs_on_preempt, cfs_migrate},
+};
+
+#define POLICY_COUNT (sizeof(policies) / sizeof(policies[0]))
+
+const struct policy *policy_find(const char *name)
+{
+  for (u32 i = 0; i < POLICY_COUNT; ++i)
+  {
+    if (strcmp(policies[i].name, name) == 0)
+    {
+      return &policies[i];
+    }
+  }
+  return NULL;
+}
+
+const char *policy_names(void)
+{
+  return "rr, fcfs, sjf, srtf, priority, mlfq, cfs";
+}
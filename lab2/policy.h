@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/queue.h>
+
+typedef uint32_t u32;
+typedef int32_t i32;
+typedef uint64_t u64;
+
+struct process
+{
+  u32 pid;
+  u32 arrival_time;
+  u32 burst_time;
+  u32 priority; /* optional fourth column, lower runs first; 0 if absent */
+  u32 affinity; /* optional fifth column, the only CPU it may run on with --cpus */
+
+  TAILQ_ENTRY(process) pointers;
+
+  /* Additional fields here */
+  u32 remaining_time;
+  bool responded;
+  u32 order; /* position in arrival order, which breaks ties between equal keys */
+  u32 last_cpu; /* with --cpus, where it last ran, to count migrations */
+
+  /* Per-policy bookkeeping, owned by whichever policy is running */
+  u64 vruntime;   /* cfs: CPU time received, starting from the queue's minimum */
+  u32 level;      /* mlfq: current queue, 0 being the highest */
+  u32 slice_used; /* mlfq: time used of the current level's quantum */
+  u32 epoch;      /* mlfq: boost count when level was last set */
+  /* End of "Additional fields here" */
+};
+
+TAILQ_HEAD(process_list, process);
+
+#define NO_AFFINITY UINT32_MAX
+
+/* A scheduling policy drives the simulator through these hooks. The
+   simulator owns the clock and the arrivals; the policy owns the run
+   queue, which holds every process that is ready but not running.
+
+   enqueue      a process arrives and becomes ready
+   pick_next    remove and return the ready process to run next
+   time_slice   how long proc may run before the policy reconsiders;
+                POLICY_RUN_TO_COMPLETION for no limit
+   on_tick      proc just ran for `ran` units, ending at `now`
+   on_preempt   proc stopped before completing, put it back in the queue
+   migrate      proc was picked from the queue with state from, but will run
+                and be requeued under state to: rebase whatever it keeps
+                relative to its queue; NULL if nothing needs rebasing
+
+   A policy with preempt_on_arrival set also has the running process
+   stopped (and passed to on_preempt) whenever another process arrives.
+   create's size is how many processes the queue may hold, as a hint for
+   its initial allocation. */
+#define POLICY_RUN_TO_COMPLETION UINT32_MAX
+
+struct policy
+{
+  const char *name;
+  bool preempt_on_arrival;
+  void *(*create)(u32 quantum, u32 size);
+  void (*destroy)(void *state);
+  void (*enqueue)(void *state, struct process *proc);
+  struct process *(*pick_next)(void *state);
+  u32 (*time_slice)(void *state, const struct process *proc);
+  void (*on_tick)(void *state, struct process *proc, u32 ran, u64 now);
+  void (*on_preempt)(void *state, struct process *proc);
+  void (*migrate)(void *from, void *to, struct process *proc);
+};
+
+/* Returns the policy called name, or NULL if there is none */
+const struct policy *policy_find(const char *name);
+
+/* Comma-separated names of every policy, for usage messages */
+const char *policy_names(void);
@@ -1,255 +1,446 @@
 #include <errno.h>
-#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/queue.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
+#include <string.h>
 #include <unistd.h>
 
-typedef uint32_t u32;
-typedef int32_t i32;
+#include "multicore.h"
+#include "policy.h"
+#include "trace.h"
 
-struct process
-{
-  u32 pid;
-  u32 arrival_time;
-  u32 burst_time;
-
-  TAILQ_ENTRY(process) pointers;
-
-  /* Additional fields here */
-  u32 remaining_time;
-  bool responded;
-  bool in_queue;
-  /* End of "Additional fields here" */
-};
-
-TAILQ_HEAD(process_list, process);
-
-u32 next_int(const char **data, const char *data_end)
+u32 next_int_from_c_str(const char *data)
 {
+  char c;
+  u32 i = 0;
   u32 current = 0;
   bool started = false;
-  while (*data != data_end)
+  while ((c = data[i++]))
   {
-    char c = **data;
-
     if (c < 0x30 || c > 0x39)
     {
-      if (started)
-      {
-        return current;
-      }
+      exit(EINVAL);
+    }
+    if (!started)
+    {
+      current = (c - 0x30);
+      started = true;
     }
     else
     {
-      if (!started)
-      {
-        current = (c - 0x30);
-        started = true;
-      }
-      else
-      {
-        current *= 10;
-        current += (c - 0x30);
-      }
+      current *= 10;
+      current += (c - 0x30);
     }
+  }
+  return current;
+}
 
-    ++(*data);
+/* Orders processes by arrival time, breaking ties by their order in the file */
+int compare_arrival(const void *a, const void *b)
+{
+  const struct process *x = a;
+  const struct process *y = b;
+  if (x->arrival_time != y->arrival_time)
+  {
+    return x->arrival_time < y->arrival_time ? -1 : 1;
   }
+  return (x->order > y->order) - (x->order < y->order);
+}
 
-  printf("Reached end of file while looking for another integer\n");
-  exit(EINVAL);
+/* Sorts the processes into arrival order once, so the simulator admits
+   them with a walk down the array, and numbers them in that order */
+void sort_by_arrival(struct process *data, u32 size)
+{
+  for (u32 i = 0; i < size; ++i)
+  {
+    data[i].order = i;
+  }
+  qsort(data, size, sizeof(struct process), compare_arrival);
+  for (u32 i = 0; i < size; ++i)
+  {
+    data[i].order = i;
+  }
 }
 
-u32 next_int_from_c_str(const char *data)
+/* Runs the trace, which must be in arrival order, to completion under
+   policy, adding up every process's waiting and response time */
+void simulate(const struct policy *policy,
+              struct process *data,
+              u32 size,
+              u32 quantum_length,
+              u64 *total_waiting_time,
+              u64 *total_response_time)
 {
-  char c;
-  u32 i = 0;
-  u32 current = 0;
-  bool started = false;
-  while ((c = data[i++]))
+  for (u32 i = 0; i < size; ++i)
   {
-    if (c < 0x30 || c > 0x39)
+    data[i].remaining_time = data[i].burst_time;
+    data[i].responded = false;
+  }
+
+  void *state = policy->create(quantum_length, size);
+  u64 current_time = 0; /* jumps from event to event */
+  u32 next_arrival = 0; /* index of the next process to admit */
+  u32 ready = 0;        /* processes in the policy's run queue */
+  u32 completed = 0;
+  struct process *preempted = NULL; /* process stopped at the last event */
+
+  /* Each iteration runs one process until its time slice expires, it
+     completes or, for preemptive policies, another process arrives */
+  while (completed < size)
+  {
+    /* Nothing ready to run, so skip the idle gap to the next arrival */
+    if (ready == 0 && preempted == NULL &&
+        current_time < data[next_arrival].arrival_time)
     {
-      exit(EINVAL);
+      current_time = data[next_arrival].arrival_time;
     }
-    if (!started)
+
+    /* Admit everything that has arrived by now, ahead of the preempted process */
+    while (next_arrival < size && data[next_arrival].arrival_time <= current_time)
     {
-      current = (c - 0x30);
-      started = true;
+      policy->enqueue(state, &data[next_arrival]);
+      ++next_arrival;
+      ++ready;
+    }
+    if (preempted != NULL)
+    {
+      policy->on_preempt(state, preempted);
+      preempted = NULL;
+      ++ready;
+    }
+
+    struct process *current_proc = policy->pick_next(state);
+    --ready;
+
+    if (!current_proc->responded)
+    {
+      current_proc->responded = true;
+      *total_response_time += current_time - current_proc->arrival_time;
+    }
+
+    u32 run_time = policy->time_slice(state, current_proc);
+    if (current_proc->remaining_time < run_time)
+    {
+      run_time = current_proc->remaining_time;
+    }
+    if (policy->preempt_on_arrival && next_arrival < size &&
+        data[next_arrival].arrival_time - current_time < run_time)
+    {
+      run_time = data[next_arrival].arrival_time - current_time;
+    }
+    current_time += run_time;
+    current_proc->remaining_time -= run_time;
+    policy->on_tick(state, current_proc, run_time, current_time);
+
+    if (current_proc->remaining_time == 0)
+    {
+      /* Every moment between arrival and completion not spent running was spent waiting */
+      *total_waiting_time += current_time - current_proc->arrival_time - current_proc->burst_time;
+      ++completed;
     }
     else
     {
-      current *= 10;
-      current += (c - 0x30);
+      preempted = current_proc;
     }
   }
-  return current;
+
+  policy->destroy(state);
 }
 
-void init_processes(const char *path,
-                    struct process **process_data,
-                    u32 *process_size)
+/* Parses a quantum sweep, "FIRST..LAST" or a single "QUANTUM" */
+bool parse_quantum_range(const char *arg, u32 *first, u32 *last)
 {
-  int fd = open(path, O_RDONLY);
-  if (fd == -1)
+  char *end;
+  errno = 0;
+  unsigned long low = strtoul(arg, &end, 10);
+  unsigned long high = low;
+  if (end != arg && strncmp(end, "..", 2) == 0)
   {
-    int err = errno;
-    perror("open");
-    exit(err);
+    const char *rest = end + 2;
+    high = strtoul(rest, &end, 10);
+    if (end == rest)
+    {
+      return false;
+    }
   }
+  if (end == arg || *end != '\0' || errno != 0 || low == 0 || low > high || high > UINT32_MAX)
+  {
+    return false;
+  }
+  *first = low;
+  *last = high;
+  return true;
+}
 
-  struct stat st;
-  if (fstat(fd, &st) == -1)
+struct sweep_result
+{
+  u64 total_waiting_time;
+  u64 total_response_time;
+};
+
+/* Quanta are handed out one at a time from next, so a worker that draws
+   a quick one moves on to another instead of idling */
+struct sweep
+{
+  const struct policy *policy;
+  u32 cpu_count; /* 0 for the single CPU simulation */
+  enum balance balance;
+  const struct process *data; /* parsed and sorted once, shared read-only */
+  u32 size;
+  u32 first_quantum;
+  u32 quantum_count;
+  atomic_uint next;
+  struct sweep_result *results; /* one per quantum, each written by one worker */
+};
+
+void *sweep_worker(void *arg)
+{
+  struct sweep *sweep = arg;
+  /* The simulation keeps its state in the processes, so each worker runs on its own copy */
+  struct process *scratch = malloc(sizeof(struct process) * sweep->size);
+  if (scratch == NULL && sweep->size > 0)
   {
     int err = errno;
-    perror("stat");
+    perror("malloc");
     exit(err);
   }
+  for (;;)
+  {
+    u32 i = atomic_fetch_add(&sweep->next, 1);
+    if (i >= sweep->quantum_count)
+    {
+      break;
+    }
+    memcpy(scratch, sweep->data, sizeof(struct process) * sweep->size);
+    struct sweep_result *result = &sweep->results[i];
+    if (sweep->cpu_count == 0)
+    {
+      simulate(sweep->policy, scratch, sweep->size, sweep->first_quantum + i,
+               &result->total_waiting_time, &result->total_response_time);
+    }
+    else
+    {
+      u64 end_time;
+      simulate_multicore(sweep->policy, sweep->balance, sweep->cpu_count, scratch, sweep->size,
+                         sweep->first_quantum + i, &result->total_waiting_time,
+                         &result->total_response_time, &end_time, NULL);
+    }
+  }
+  free(scratch);
+  return NULL;
+}
 
-  u32 size = st.st_size;
-  const char *data_start = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
-  if (data_start == MAP_FAILED)
+/* Simulates every quantum from first to last on a pool of one thread per
+   CPU and prints a row of averages for each */
+void run_sweep(const struct policy *policy,
+               u32 cpu_count,
+               enum balance balance,
+               const struct process *data,
+               u32 size,
+               u32 first_quantum,
+               u32 last_quantum)
+{
+  struct sweep sweep = {
+    .policy = policy,
+    .cpu_count = cpu_count,
+    .balance = balance,
+    .data = data,
+    .size = size,
+    .first_quantum = first_quantum,
+    .quantum_count = last_quantum - first_quantum + 1,
+  };
+  atomic_init(&sweep.next, 0);
+  sweep.results = calloc(sweep.quantum_count, sizeof(struct sweep_result));
+  if (sweep.results == NULL)
   {
     int err = errno;
-    perror("mmap");
+    perror("calloc");
     exit(err);
   }
 
-  const char *data_end = data_start + size;
-  const char *data = data_start;
-
-  *process_size = next_int(&data, data_end);
-
-  *process_data = calloc(sizeof(struct process), *process_size);
-  if (*process_data == NULL)
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  u32 thread_count = cpus < 1 ? 1 : (u32)cpus;
+  if (thread_count > sweep.quantum_count)
+  {
+    thread_count = sweep.quantum_count;
+  }
+  pthread_t *threads = calloc(thread_count, sizeof(pthread_t));
+  if (threads == NULL)
   {
     int err = errno;
     perror("calloc");
     exit(err);
   }
+  for (u32 i = 0; i < thread_count; ++i)
+  {
+    int err = pthread_create(&threads[i], NULL, sweep_worker, &sweep);
+    if (err != 0)
+    {
+      fprintf(stderr, "pthread_create: %s\n", strerror(err));
+      exit(err);
+    }
+  }
+  for (u32 i = 0; i < thread_count; ++i)
+  {
+    pthread_join(threads[i], NULL);
+  }
 
-  for (u32 i = 0; i < *process_size; ++i)
+  printf("%7s  %20s  %21s\n", "Quantum", "Average waiting time", "Average response time");
+  for (u32 i = 0; i < sweep.quantum_count; ++i)
   {
-    (*process_data)[i].pid = next_int(&data, data_end);
-    (*process_data)[i].arrival_time = next_int(&data, data_end);
-    (*process_data)[i].burst_time = next_int(&data, data_end);
+    const struct sweep_result *result = &sweep.results[i];
+    printf("%7u  %20.2f  %21.2f\n", first_quantum + i,
+           (float)result->total_waiting_time / (float)size,
+           (float)result->total_response_time / (float)size);
   }
 
-  munmap((void *)data, size);
-  close(fd);
+  free(threads);
+  free(sweep.results);
 }
 
 int main(int argc, char *argv[])
 {
-  if (argc != 3)
+  static const struct option options[] = {
+    {"policy", required_argument, NULL, 'p'},
+    {"quantum", required_argument, NULL, 'q'},
+    {"cpus", required_argument, NULL, 'c'},
+    {"balance", required_argument, NULL, 'b'},
+    {"parse-threads", required_argument, NULL, 't'},
+    {NULL, 0, NULL, 0},
+  };
+  const struct policy *policy = policy_find("rr");
+  u32 cpu_count = 0;
+  enum balance balance = BALANCE_GLOBAL;
+  bool sweep = false;
+  u32 first_quantum = 0;
+  u32 last_quantum = 0;
+  u32 parse_threads = 0;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "p:q:c:b:t:", options, NULL)) != -1)
   {
+    switch (opt)
+    {
+    case 'p':
+      policy = policy_find(optarg);
+      if (policy == NULL)
+      {
+        fprintf(stderr, "Unknown policy '%s' (choose from %s)\n", optarg, policy_names());
+        return EINVAL;
+      }
+      break;
+    case 'q':
+      if (!parse_quantum_range(optarg, &first_quantum, &last_quantum))
+      {
+        fprintf(stderr, "Invalid quantum range '%s' (expected FIRST..LAST)\n", optarg);
+        return EINVAL;
+      }
+      sweep = true;
+      break;
+    case 'c':
+      cpu_count = next_int_from_c_str(optarg);
+      if (cpu_count == 0)
+      {
+        return EINVAL;
+      }
+      break;
+    case 'b':
+      if (!balance_parse(optarg, &balance))
+      {
+        fprintf(stderr, "Unknown balance '%s' (choose from global, steal)\n", optarg);
+        return EINVAL;
+      }
+      break;
+    case 't':
+      parse_threads = next_int_from_c_str(optarg);
+      if (parse_threads == 0)
+      {
+        return EINVAL;
+      }
+      break;
+    default:
+      return EINVAL;
+    }
+  }
+  if (argc - optind != (sweep ? 1 : 2))
+  {
+    fprintf(stderr,
+            "Usage: %s [--policy NAME] [--cpus N [--balance global|steal]] [--parse-threads N] FILE QUANTUM\n"
+            "       %s [--policy NAME] [--cpus N [--balance global|steal]] [--parse-threads N] --quantum FIRST..LAST FILE\n",
+            argv[0], argv[0]);
     return EINVAL;
   }
   struct process *data;
   u32 size;
-  init_processes(argv[1], &data, &size);
-
-  u32 quantum_length = next_int_from_c_str(argv[2]);
-
-  struct process_list list;
-  TAILQ_INIT(&list);
-
-  u32 total_waiting_time = 0;
-  u32 total_response_time = 0;
-
-  /* Your code here */
-  u32 current_time = 0; // initialize current simulation time to 0
-  bool all_done = false; // check if all processes are done
-  u32 time_slice = 0; // time slice for quantum
-
-  // loop to initialize each process's remaining time, response flag, queue status
-  for (u32 i = 0; i < size; ++i) {
-    data[i].remaining_time = data[i].burst_time; // set remaining time of current process to burst time
-    data[i].responded = false;
-    data[i].in_queue = false;
-  }
-
-  struct process *current_proc = NULL;
-  struct process *next_proc = NULL;
+  init_processes(argv[optind], parse_threads, &data, &size);
+  sort_by_arrival(data, size);
 
-  // loop until all processes are complete
-  while (!all_done) {
-    // enqueue processes that have just arrived
-    for (u32 i = 0; i < size; ++i) {
-      // if current process's arrival time is now and it's not in the queue
-      if (data[i].arrival_time == current_time && !data[i].in_queue) {
-        TAILQ_INSERT_TAIL(&list, &data[i], pointers); // insert to end of list
-        data[i].in_queue = true;
-      }
+  for (u32 i = 0; i < size && cpu_count > 0; ++i)
+  {
+    if (data[i].affinity != NO_AFFINITY && data[i].affinity >= cpu_count)
+    {
+      fprintf(stderr, "Process %u has affinity for CPU %u, but there are only %u CPUs\n",
+              data[i].pid, data[i].affinity, cpu_count);
+      return EINVAL;
     }
+  }
 
-    // if current time slice is over or the current process is done
-    if (time_slice == 0 || (current_proc != NULL && current_proc->remaining_time == 0)) {
-      // if there is a current process and it still has time left
-      if (current_proc != NULL && current_proc->remaining_time > 0) {
-        TAILQ_INSERT_TAIL(&list, current_proc, pointers); // reinsert current process to end of queue
-        current_proc->in_queue = true;
-      }
-
-      // if the list is not empty, run next process
-      if (!TAILQ_EMPTY(&list)) {
-        next_proc = TAILQ_FIRST(&list);
-        TAILQ_REMOVE(&list, next_proc, pointers); // remove next process from list
-        next_proc->in_queue = false;
-        
-        // if the next process has not been responded to yet
-        if (!next_proc->responded) {
-          next_proc->responded = true;
+  if (sweep)
+  {
+    run_sweep(policy, cpu_count, balance, data, size, first_quantum, last_quantum);
+    free(data);
+    return 0;
+  }
 
-          // add the response time for the next process to the total response time
-          total_response_time += current_time - next_proc->arrival_time;
-        }
+  u32 quantum_length = next_int_from_c_str(argv[optind + 1]);
+  if (quantum_length == 0)
+  {
+    return EINVAL;
+  }
 
-        time_slice = quantum_length; // reset time slice to quantum length for next process
-        current_proc = next_proc;
-      }
+  u64 total_waiting_time = 0;
+  u64 total_response_time = 0;
+  struct cpu_stats *cpu_stats = NULL;
+  u64 end_time = 0;
+  if (cpu_count == 0)
+  {
+    simulate(policy, data, size, quantum_length, &total_waiting_time, &total_response_time);
+  }
+  else
+  {
+    cpu_stats = calloc(cpu_count, sizeof(struct cpu_stats));
+    if (cpu_stats == NULL)
+    {
+      int err = errno;
+      perror("calloc");
+      exit(err);
     }
+    simulate_multicore(policy, balance, cpu_count, data, size, quantum_length,
+                       &total_waiting_time, &total_response_time, &end_time, cpu_stats);
+  }
 
-    // if there is a current process to run
-    if (current_proc != NULL) {
-      current_proc->remaining_time--; // decrement remaining time of current process
-      time_slice--;
-      current_time++;
+  printf("Average waiting time: %.2f\n", (float)total_waiting_time / (float)size);
+  printf("Average response time: %.2f\n", (float)total_response_time / (float)size);
 
-      // increment waiting time for all processes in the queue
-      struct process *tmp;
-      TAILQ_FOREACH(tmp, &list, pointers) {
-        if (tmp != current_proc) {
-          total_waiting_time++;
-        }
-      }
-    } else {
-      // if no current process, just increment the simulation time
-      current_time++;
+  if (cpu_stats != NULL)
+  {
+    u64 migrations = 0;
+    for (u32 i = 0; i < cpu_count; ++i)
+    {
+      migrations += cpu_stats[i].migrations;
     }
-
-    all_done = true;
-
-    // check if there are still processes with remaining time
-    for (u32 i = 0; i < size; ++i) {
-      // if any process still has remaining time
-      if (data[i].remaining_time > 0) {
-        // not all processes are done
-        all_done = false;
-        break;
-      }
+    printf("Migrations: %llu\n", (unsigned long long)migrations);
+    for (u32 i = 0; i < cpu_count; ++i)
+    {
+      printf("CPU %u: %.2f%% utilization, migrations in: %llu\n", i,
+             end_time == 0 ? 0.0 : 100.0 * cpu_stats[i].busy_time / end_time,
+             (unsigned long long)cpu_stats[i].migrations);
     }
+    free(cpu_stats);
   }
-  
-  /* End of "Your code here" */
-
-  printf("Average waiting time: %.2f\n", (float)total_waiting_time / (float)size);
-  printf("Average response time: %.2f\n", (float)total_response_time / (float)size);
 
   free(data);
   return 0;
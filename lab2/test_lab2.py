@@ -76,3 +76,111 @@ class TestLab2(unittest.TestCase):
 
                     self.assertTrue(result,f"\n Cannot handle re-queue and new process arrival at the same time\n   Quantum Time: {x}\n Correct Results: Avg Wait. Time:{correctAvgWaitTime[x]}, Avg. Resp. Time:{correctAvgRespTime[x]}\n    Your Results: Avg Wait. Time:{testAvgWaitTime}, Avg. Resp. Time:{testAvgRespTime}\n")
 
+    def test_policies(self):
+            self.assertTrue(self.make, msg='make failed')
+
+            # (policy, avg. waiting time, avg. response time) on processes.txt, worked by hand
+            expected = (('rr',   'processes.txt', 3, 7.0,  2.75),
+                        ('fcfs', 'processes.txt', 3, 4.75, 4.75),
+                        ('sjf',  'processes.txt', 3, 4.0,  4.0),
+                        ('srtf', 'processes.txt', 3, 3.0,  0.5),
+                        # P1 runs 0-2 and 11-16, P2 2-5 and 9-10, P4 5-9, P3 10-11
+                        ('priority', 'priority.txt', 3, 4.75, 1.5),
+                        # P1 0-3, P2 3-6, P3 6-7, P4 7-10, then P1, P2, P4 at vruntime 3
+                        ('cfs',  'processes.txt', 3, 6.25, 1.25),
+                        # P1 0-3 (resuming ahead of P2 after its arrival) and P2 3-6 use a whole
+                        # quantum and drop a level, P3 6-7, P4 7-10, then P1 10-14, P2 14-15, P4 15-16
+                        ('mlfq', 'processes.txt', 3, 6.25, 1.25),
+                        # Process 1 drops to level 1 at time 1 and a short process arrives every
+                        # unit, so only the boost at time 64 lets it run, ahead of processes 65 to 71,
+                        # which each wait 1; it finishes at 73
+                        ('mlfq', 'boost.txt', 1, 77 / 71, 7 / 71))
+
+            with tempfile.TemporaryDirectory() as directory:
+                traces = {'processes.txt': 'processes.txt',
+                          'priority.txt': os.path.join(directory, 'priority.txt'),
+                          'boost.txt': os.path.join(directory, 'boost.txt')}
+                with open(traces['priority.txt'], 'w') as trace:
+                    trace.write('4\n1, 0, 7, 3\n2, 2, 4, 1\n3, 4, 1, 2\n4, 5, 4, 0\n')
+                with open(traces['boost.txt'], 'w') as trace:
+                    trace.write('71\n1, 0, 3\n' + ''.join(f'{k + 1}, {k}, 1\n' for k in range(1, 71)))
+
+                for policy, trace, quantum, correctAvgWaitTime, correctAvgRespTime in expected:
+                    cl_result = subprocess.check_output(('./rr','--policy',policy,traces[trace],str(quantum))).decode()
+                    lines=cl_result.split('\n')
+                    testAvgWaitTime=float(lines[0].split(':')[1])
+                    testAvgRespTime=float(lines[1].split(':')[1])
+
+                    self.assertEqual((testAvgWaitTime, testAvgRespTime), (round(correctAvgWaitTime, 2), round(correctAvgRespTime, 2)),
+                                     f"\n    Policy: {policy}\n    Trace: {trace}\n")
+
+    def test_quantum_sweep(self):
+            self.assertTrue(self.make, msg='make failed')
+
+            correctAvgWaitTime=(0,5.5, 5.0,  7,   4.5,  5.5,  6.25, 4.75)
+            correctAvgRespTime=(0,0.75,1.5,2.75,  3.25, 3.25, 4,    4.75)
+
+            cl_result = subprocess.check_output(('./rr','--quantum','1..7','processes.txt')).decode()
+            rows=[line.split() for line in cl_result.strip().split('\n')[1:]]
+
+            self.assertEqual([int(row[0]) for row in rows], list(range(1,8)))
+            for row in rows:
+                x=int(row[0])
+                self.assertEqual((float(row[1]), float(row[2])), (correctAvgWaitTime[x], correctAvgRespTime[x]),
+                                 f"\n    Quantum Time: {x}\n")
+
+    def test_multicore(self):
+            self.assertTrue(self.make, msg='make failed')
+
+            # (policy, balance, trace, quantum, avg. waiting time, avg. response time,
+            #  migrations, (utilization, migrations in) of each CPU) on 2 CPUs, worked by hand
+            expected = (('rr',   'global', 'processes.txt', 3, 1.0, 0.5, 1, (('100.00', 0), ('60.00', 1))),
+                        # P1 keeps CPU 0 but for P3 at 6-7, P2 and P4 share CPU 1, and at 8 CPU 0
+                        # steals P4's last unit while CPU 1 finishes P2
+                        ('cfs',  'steal', 'processes.txt', 3, 1.5, 0.5, 1, (('100.00', 1), ('77.78', 0))),
+                        # P3 arrives on CPU 0 and preempts P1, which is down a level, and P4 follows
+                        # it there, so CPU 1 steals P1 at 6 once P2 is done
+                        ('mlfq', 'steal', 'processes.txt', 3, 0.5, 0.0, 1, (('100.00', 0), ('77.78', 1))),
+                        # CPU 1 steals P3 at 5. Its vruntime 2 is no lead over CPU 0's queue, so it
+                        # restarts at CPU 1's 1, ties P5 at 7, goes first and finishes at 8
+                        ('cfs',  'steal', 'cfs-steal.txt', 1, 1.4, 0.0, 1, (('81.82', 0), ('72.73', 1))),
+                        # P1 and P2 are pinned to CPU 1 and take turns there while P4 waits for
+                        # CPU 0 to finish P3, and CPU 0 sits idle beside P2's last unit at 6
+                        ('rr',   'global', 'pinned.txt', 2, 1.75, 0.75, 0, (('71.43', 0), ('100.00', 0))),
+                        ('rr',   'steal', 'pinned.txt', 2, 1.75, 0.75, 0, (('71.43', 0), ('100.00', 0))))
+
+            with tempfile.TemporaryDirectory() as directory:
+                traces = {'processes.txt': 'processes.txt',
+                          'cfs-steal.txt': os.path.join(directory, 'cfs-steal.txt'),
+                          'pinned.txt': os.path.join(directory, 'pinned.txt')}
+                with open(traces['cfs-steal.txt'], 'w') as trace:
+                    trace.write('5\n1, 2, 5\n2, 3, 2\n3, 4, 3\n4, 6, 3\n5, 6, 4\n')
+                with open(traces['pinned.txt'], 'w') as trace:
+                    trace.write('4\n1, 0, 4, 0, 1\n2, 0, 3, 0, 1\n3, 1, 2\n4, 2, 3\n')
+
+                for policy, balance, trace, quantum, correctAvgWaitTime, correctAvgRespTime, migrations, cpus in expected:
+                    cl_result = subprocess.check_output(('./rr','--policy',policy,'--cpus','2','--balance',balance,
+                                                         traces[trace],str(quantum))).decode()
+                    lines=cl_result.strip().split('\n')
+
+                    message=f"\n    Policy: {policy}\n    Balance: {balance}\n    Trace: {trace}\n"
+                    self.assertEqual((float(lines[0].split(':')[1]), float(lines[1].split(':')[1])),
+                                     (correctAvgWaitTime, correctAvgRespTime), message)
+                    self.assertEqual(lines[2:], [f'Migrations: {migrations}'] +
+                                     [f'CPU {i}: {utilization}% utilization, migrations in: {migrated}'
+                                      for i, (utilization, migrated) in enumerate(cpus)], message)
+
+    def test_parse_threads(self):
+            self.assertTrue(self.make, msg='make failed')
+
+            # One process per line, with long numbers and no newline after the last one
+            lines=[f'{pid}, {pid * 7 % 1000}, {pid % 9 + 1}' for pid in range(123456780, 123458780)]
+            with tempfile.TemporaryDirectory() as directory:
+                path=os.path.join(directory, 'trace.txt')
+                with open(path, 'w') as trace:
+                    trace.write(f'{len(lines)}\n' + '\n'.join(lines))
+
+                for trace_path in ('processes.txt', path):
+                    results=[subprocess.check_output(('./rr','--parse-threads',str(threads),trace_path,'3')).decode()
+                             for threads in (1, 2, 5)]
+                    self.assertEqual(results[1:], results[:1] * 2, f"\n    Trace: {trace_path}\n")
@@ -0,0 +1,310 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+static bool is_digit(char c)
+{
+  return c >= 0x30 && c <= 0x39;
+}
+
+static void *checked_realloc(void *ptr, size_t size)
+{
+  void *result = realloc(ptr, size);
+  if (result == NULL && size > 0)
+  {
+    int err = errno;
+    perror("realloc");
+    exit(err);
+  }
+  return result;
+}
+
+/* The eight bytes at p, the first of them in the low byte */
+static u64 load_word(const char *p)
+{
+  u64 word;
+  memcpy(&word, p, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  word = __builtin_bswap64(word);
+#endif
+  return word;
+}
+
+static u32 check_u32(u64 value)
+{
+  if (value > UINT32_MAX)
+  {
+    printf("Integer in trace does not fit in 32 bits\n");
+    exit(EINVAL);
+  }
+  return value;
+}
+
+/* Parses the run of digits starting at *data, eight bytes at a time while
+   eight remain before data_end, and the last few one at a time */
+static u32 parse_digits(const char **data, const char *data_end)
+{
+  static const u64 powers_of_10[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+  const char *p = *data;
+  u64 value = 0;
+  while (data_end - p >= 8)
+  {
+    /* Digits become 0 to 9; anything else gets its high bit set in non_digits */
+    u64 word = load_word(p) ^ 0x3030303030303030;
+    u64 non_digits = (((word & 0x7f7f7f7f7f7f7f7f) + 0x7676767676767676) | word) & 0x8080808080808080;
+    u32 count = non_digits == 0 ? 8 : __builtin_ctzll(non_digits) / 8;
+    if (count == 0)
+    {
+      *data = p;
+      return value;
+    }
+
+    /* Drop the bytes after the digits, which leaves leading zeros in their
+       place, then combine neighbouring digits into pairs, fours and eights */
+    word <<= 8 * (8 - count);
+    word = (word * 10 + (word >> 8)) & 0x00ff00ff00ff00ff;
+    word = (word * 100 + (word >> 16)) & 0x0000ffff0000ffff;
+    word = (word * 10000 + (word >> 32)) & 0x00000000ffffffff;
+    value = check_u32(value * powers_of_10[count] + word);
+    p += count;
+    if (count < 8)
+    {
+      *data = p;
+      return value;
+    }
+  }
+
+  while (p != data_end && is_digit(*p))
+  {
+    value = check_u32(value * 10 + (*p - 0x30));
+    ++p;
+  }
+  *data = p;
+  return value;
+}
+
+u32 next_int(const char **data, const char *data_end)
+{
+  const char *p = *data;
+  while (p != data_end && !is_digit(*p))
+  {
+    ++p;
+  }
+  if (p == data_end)
+  {
+    printf("Reached end of file while looking for another integer\n");
+    exit(EINVAL);
+  }
+  *data = p;
+  return parse_digits(data, data_end);
+}
+
+u32 next_int_on_line(const char **data, const char *data_end, u32 fallback)
+{
+  while (*data != data_end && **data != '\n' && !is_digit(**data))
+  {
+    ++(*data);
+  }
+  if (*data == data_end || **data == '\n')
+  {
+    return fallback;
+  }
+  return parse_digits(data, data_end);
+}
+
+static void parse_process(const char **data, const char *data_end, struct process *proc)
+{
+  proc->pid = next_int(data, data_end);
+  proc->arrival_time = next_int(data, data_end);
+  proc->burst_time = next_int(data, data_end);
+  proc->priority = next_int_on_line(data, data_end, 0);
+  proc->affinity = next_int_on_line(data, data_end, NO_AFFINITY);
+}
+
+/* The lines from start up to end, which both sit at the start of a line.
+   A process belongs to the chunk its pid starts in. */
+struct parse_chunk
+{
+  const char *start;
+  const char *end;
+  const char *data_end;
+  struct process *processes;
+  u32 count;
+  u32 capacity; /* a guess from the chunk's share of the file, grown as needed */
+};
+
+static void *parse_chunk_worker(void *arg)
+{
+  struct parse_chunk *chunk = arg;
+  const char *data = chunk->start;
+  for (;;)
+  {
+    while (data < chunk->end && !is_digit(*data))
+    {
+      ++data;
+    }
+    if (data >= chunk->end)
+    {
+      break;
+    }
+    if (chunk->count == chunk->capacity)
+    {
+      chunk->capacity = chunk->capacity == 0 ? 16 : chunk->capacity * 2;
+      chunk->processes = checked_realloc(chunk->processes, sizeof(struct process) * chunk->capacity);
+    }
+    struct process *proc = &chunk->processes[chunk->count++];
+    memset(proc, 0, sizeof(*proc));
+    parse_process(&data, chunk->data_end, proc);
+  }
+  return NULL;
+}
+
+/* Splits the lines after the count into thread_count chunks of about the
+   same length, parses them all at once, and copies the first size
+   processes out in file order */
+static void parse_parallel(const char *data,
+                           const char *data_end,
+                           u32 thread_count,
+                           struct process *processes,
+                           u32 size)
+{
+  struct parse_chunk *chunks = calloc(thread_count, sizeof(struct parse_chunk));
+  pthread_t *threads = calloc(thread_count, sizeof(pthread_t));
+  if (chunks == NULL || threads == NULL)
+  {
+    int err = errno;
+    perror("calloc");
+    exit(err);
+  }
+
+  size_t length = data_end - data;
+  for (u32 i = 0; i < thread_count; ++i)
+  {
+    const char *start = data + length / thread_count * i;
+    if (i > 0)
+    {
+      const char *newline = memchr(start, '\n', data_end - start);
+      start = newline == NULL ? data_end : newline + 1;
+      chunks[i - 1].end = start;
+    }
+    chunks[i].start = start;
+    chunks[i].data_end = data_end;
+    chunks[i].capacity = (u32)((double)size / thread_count) + 16;
+    chunks[i].processes = checked_realloc(NULL, sizeof(struct process) * chunks[i].capacity);
+  }
+  chunks[thread_count - 1].end = data_end;
+
+  for (u32 i = 0; i < thread_count; ++i)
+  {
+    int err = pthread_create(&threads[i], NULL, parse_chunk_worker, &chunks[i]);
+    if (err != 0)
+    {
+      fprintf(stderr, "pthread_create: %s\n", strerror(err));
+      exit(err);
+    }
+  }
+
+  u32 copied = 0;
+  for (u32 i = 0; i < thread_count; ++i)
+  {
+    pthread_join(threads[i], NULL);
+    u32 count = chunks[i].count < size - copied ? chunks[i].count : size - copied;
+    memcpy(processes + copied, chunks[i].processes, sizeof(struct process) * count);
+    copied += count;
+    free(chunks[i].processes);
+  }
+  if (copied < size)
+  {
+    printf("Reached end of file while looking for another integer\n");
+    exit(EINVAL);
+  }
+
+  free(threads);
+  free(chunks);
+}
+
+void init_processes(const char *path,
+                    u32 thread_count,
+                    struct process **process_data,
+                    u32 *process_size)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd == -1)
+  {
+    int err = errno;
+    perror("open");
+    exit(err);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1)
+  {
+    int err = errno;
+    perror("stat");
+    exit(err);
+  }
+  if ((uint64_t)st.st_size > SIZE_MAX)
+  {
+    fprintf(stderr, "%s is too large to map\n", path);
+    exit(EFBIG);
+  }
+
+  size_t size = st.st_size;
+  if (size == 0)
+  {
+    printf("Reached end of file while looking for another integer\n");
+    exit(EINVAL);
+  }
+  const char *data_start = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data_start == MAP_FAILED)
+  {
+    int err = errno;
+    perror("mmap");
+    exit(err);
+  }
+  /* Only a hint, so a failure is harmless */
+  madvise((void *)data_start, size, MADV_SEQUENTIAL);
+
+  const char *data_end = data_start + size;
+  const char *data = data_start;
+
+  *process_size = next_int(&data, data_end);
+
+  *process_data = calloc(sizeof(struct process), *process_size);
+  if (*process_data == NULL && *process_size > 0)
+  {
+    int err = errno;
+    perror("calloc");
+    exit(err);
+  }
+
+  if (thread_count == 0)
+  {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    thread_count = size < PARALLEL_PARSE_MIN_SIZE || cpus < 1 ? 1 : (u32)cpus;
+  }
+
+  if (thread_count == 1)
+  {
+    for (u32 i = 0; i < *process_size; ++i)
+    {
+      parse_process(&data, data_end, &(*process_data)[i]);
+    }
+  }
+  else
+  {
+    parse_parallel(data, data_end, thread_count, *process_data, *process_size);
+  }
+
+  munmap((void *)data_start, size);
+  close(fd);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "policy.h"
+
+/* Returns the next integer in [*data, data_end), leaving *data just past
+   it. Exits if there is none, or if it does not fit in 32 bits. */
+u32 next_int(const char **data, const char *data_end);
+
+/* Like next_int, but returns fallback if the current line has no more integers */
+u32 next_int_on_line(const char **data, const char *data_end, u32 fallback);
+
+/* Reads the trace at path: a process count, then one process per line.
+   thread_count is how many threads split the lines between them, or 0 to
+   use one per CPU for traces of at least PARALLEL_PARSE_MIN_SIZE bytes and
+   a single thread otherwise. */
+void init_processes(const char *path,
+                    u32 thread_count,
+                    struct process **process_data,
+                    u32 *process_size);
+
+#define PARALLEL_PARSE_MIN_SIZE (64 << 20)
@@ -0,0 +1,220 @@
+#define _GNU_SOURCE /* sched_getaffinity, pthread_attr_setaffinity_np */
+#include "hash-table-affinity.h"
+
+#include <dirent.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Topology comes from sysfs rather than libnuma, so nothing extra is
+   needed to build; a missing file just means a single node or socket. */
+struct cpu_info {
+	int cpu;
+	int node;
+	int package;
+	int core;
+	int core_rank;    /* this core's position among its node's cores */
+	int sibling_rank; /* 0 for a core's first hyperthread, 1 for the next... */
+};
+
+static const char *const affinity_names[] = {
+	[AFFINITY_NONE] = "none",
+	[AFFINITY_COMPACT] = "compact",
+	[AFFINITY_SCATTER] = "scatter",
+};
+
+bool affinity_parse(const char *name, enum affinity *affinity)
+{
+	for (size_t i = 0; i < sizeof(affinity_names) / sizeof(affinity_names[0]); ++i) {
+		if (strcmp(name, affinity_names[i]) == 0) {
+			*affinity = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char *affinity_name(enum affinity affinity)
+{
+	return affinity_names[affinity];
+}
+
+static int read_topology(int cpu, const char *name, int fallback)
+{
+	char path[128];
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		return fallback;
+	}
+	int value;
+	if (fscanf(file, "%d", &value) != 1) {
+		value = fallback;
+	}
+	fclose(file);
+	return value;
+}
+
+int affinity_cpu_node(int cpu)
+{
+	/* The CPU's directory holds a nodeN link to its node */
+	char path[64];
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	DIR *dir = opendir(path);
+	if (dir == NULL) {
+		return 0;
+	}
+	int node = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (sscanf(entry->d_name, "node%d", &node) == 1) {
+			break;
+		}
+	}
+	closedir(dir);
+	return node;
+}
+
+/* Fills cpus with the CPUs this process may run on; returns how many */
+static size_t usable_cpus(struct cpu_info **cpus)
+{
+#if defined(__linux__)
+	cpu_set_t set;
+	if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+		perror("sched_getaffinity");
+		exit(EXIT_FAILURE);
+	}
+	int cpu_limit = CPU_SETSIZE;
+	size_t cpu_count = CPU_COUNT(&set);
+#else
+	/* No affinity masks: treat every online CPU as usable */
+	int cpu_limit = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t cpu_count = cpu_limit;
+#endif
+	*cpus = calloc(cpu_count, sizeof(struct cpu_info));
+	if (*cpus == NULL) {
+		fprintf(stderr, "Failed to allocate memory for CPU topology\n");
+		exit(EXIT_FAILURE);
+	}
+	size_t count = 0;
+	for (int cpu = 0; cpu < cpu_limit; ++cpu) {
+#if defined(__linux__)
+		if (!CPU_ISSET(cpu, &set)) {
+			continue;
+		}
+#endif
+		struct cpu_info *info = &(*cpus)[count++];
+		info->cpu = cpu;
+		info->node = affinity_cpu_node(cpu);
+		info->package = read_topology(cpu, "physical_package_id", 0);
+		info->core = read_topology(cpu, "core_id", cpu);
+	}
+	/* A core is ranked by its first sibling, and the others copy that rank */
+	for (size_t i = 0; i < count; ++i) {
+		struct cpu_info *info = &(*cpus)[i];
+		for (size_t j = 0; j < i; ++j) {
+			const struct cpu_info *other = &(*cpus)[j];
+			if (other->package == info->package && other->core == info->core) {
+				if (info->sibling_rank++ == 0) {
+					info->core_rank = other->core_rank;
+				}
+			}
+			else if (other->node == info->node && other->sibling_rank == 0 && info->sibling_rank == 0) {
+				++info->core_rank;
+			}
+		}
+	}
+	return count;
+}
+
+int affinity_node_count(void)
+{
+	struct cpu_info *cpus;
+	size_t count = usable_cpus(&cpus);
+	int nodes = 0;
+	for (size_t i = 0; i < count; ++i) {
+		if (cpus[i].node + 1 > nodes) {
+			nodes = cpus[i].node + 1;
+		}
+	}
+	free(cpus);
+	return nodes;
+}
+
+static int compare_ints(int a, int b)
+{
+	return (a > b) - (a < b);
+}
+
+/* Node by node, and core by core within a node, with siblings adjacent */
+static int compare_compact(const void *a, const void *b)
+{
+	const struct cpu_info *x = a, *y = b;
+	int order = compare_ints(x->node, y->node);
+	if (order == 0) order = compare_ints(x->core_rank, y->core_rank);
+	if (order == 0) order = compare_ints(x->sibling_rank, y->sibling_rank);
+	if (order == 0) order = compare_ints(x->cpu, y->cpu);
+	return order;
+}
+
+/* One core from each node in turn, then the next core, and only once every
+   core is in use, the second hyperthread of each */
+static int compare_scatter(const void *a, const void *b)
+{
+	const struct cpu_info *x = a, *y = b;
+	int order = compare_ints(x->sibling_rank, y->sibling_rank);
+	if (order == 0) order = compare_ints(x->core_rank, y->core_rank);
+	if (order == 0) order = compare_ints(x->node, y->node);
+	if (order == 0) order = compare_ints(x->cpu, y->cpu);
+	return order;
+}
+
+int *affinity_plan(enum affinity affinity, uint32_t threads)
+{
+	if (affinity == AFFINITY_NONE) {
+		return NULL;
+	}
+	struct cpu_info *cpus;
+	size_t count = usable_cpus(&cpus);
+	qsort(cpus, count, sizeof(struct cpu_info),
+	      affinity == AFFINITY_COMPACT ? compare_compact : compare_scatter);
+	int *plan = calloc(threads, sizeof(int));
+	if (plan == NULL) {
+		fprintf(stderr, "Failed to allocate memory for thread placement\n");
+		exit(EXIT_FAILURE);
+	}
+	for (uint32_t i = 0; i < threads; ++i) {
+		plan[i] = cpus[i % count].cpu;
+	}
+	free(cpus);
+	return plan;
+}
+
+int affinity_thread_create(pthread_t *thread, int cpu, void *(*run)(void *), void *arg)
+{
+#if defined(__linux__)
+	if (cpu < 0) {
+		return pthread_create(thread, NULL, run, arg);
+	}
+	pthread_attr_t attr;
+	int err = pthread_attr_init(&attr);
+	if (err != 0) {
+		return err;
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	err = pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+	if (err == 0) {
+		err = pthread_create(thread, &attr, run, arg);
+	}
+	pthread_attr_destroy(&attr);
+	return err;
+#else
+	/* Elsewhere threads cannot be pinned, so every placement runs unpinned */
+	(void) cpu;
+	return pthread_create(thread, NULL, run, arg);
+#endif
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Where the tester's worker threads run. compact fills one NUMA node, core
+   by core, before moving on to the next; scatter deals threads out to the
+   nodes in turn, and to separate cores before hyperthread siblings. */
+enum affinity {
+	AFFINITY_NONE,
+	AFFINITY_COMPACT,
+	AFFINITY_SCATTER,
+};
+
+bool affinity_parse(const char *name, enum affinity *affinity);
+const char *affinity_name(enum affinity affinity);
+
+/* Returns the CPU for each of `threads` threads, wrapping around if there
+   are more threads than CPUs this process may use, or NULL for
+   AFFINITY_NONE. The caller frees the array. */
+int *affinity_plan(enum affinity affinity, uint32_t threads);
+
+/* The NUMA node of a CPU, and the number of nodes the usable CPUs are on,
+   both as sysfs reports them (node 0 where it does not) */
+int affinity_cpu_node(int cpu);
+int affinity_node_count(void);
+
+/* pthread_create, pinned to cpu unless cpu is negative */
+int affinity_thread_create(pthread_t *thread, int cpu, void *(*run)(void *), void *arg);
@@ -0,0 +1,149 @@
+#include "hash-table-arena.h"
+#include "hash-table-common.h"
+
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#define SLAB_SIZE (64 * 1024)
+#define ARENA_SHARDS 64 // threads beyond this share a shard, behind its mutex
+#define CACHE_LINE_SIZE 64
+#define FREE_CLASSES 16 // freed blocks of up to 16 * alignof(max_align_t) bytes are reused
+
+struct slab {
+    struct slab *next;
+    alignas(max_align_t) char data[];
+};
+
+struct free_block {
+    struct free_block *next;
+};
+
+struct arena_shard {
+    pthread_mutex_t mutex;
+    struct slab *slabs; // the newest slab is the one being carved up
+    size_t used;        // bytes handed out from the newest slab
+    struct free_block *free_lists[FREE_CLASSES]; // by size / alignof(max_align_t) - 1
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct hash_table_arena {
+    struct arena_shard shards[ARENA_SHARDS];
+};
+
+struct hash_table_arena *hash_table_arena_create() {
+    struct hash_table_arena *arena = aligned_alloc(CACHE_LINE_SIZE, sizeof(struct hash_table_arena));
+    if (arena == NULL) {
+        fprintf(stderr, "Failed to allocate memory for arena\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(arena, 0, sizeof(struct hash_table_arena));
+    for (size_t i = 0; i < ARENA_SHARDS; ++i) {
+        int ret = pthread_mutex_init(&arena->shards[i].mutex, NULL);
+        if (ret != 0) {
+            fprintf(stderr, "Error initializing mutex: %d\n", ret);
+            exit(ret);
+        }
+    }
+    return arena;
+}
+
+static struct slab *alloc_slab(size_t capacity, struct slab *next) {
+    struct slab *slab = malloc(sizeof(struct slab) + capacity);
+    if (slab == NULL) {
+        fprintf(stderr, "Failed to allocate memory for arena slab\n");
+        exit(EXIT_FAILURE);
+    }
+    slab->next = next;
+    return slab;
+}
+
+static size_t round_size(size_t size) {
+    return (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+}
+
+static bool has_free_class(size_t rounded_size) {
+    return rounded_size > 0 && rounded_size <= FREE_CLASSES * alignof(max_align_t);
+}
+
+static size_t free_class(size_t rounded_size) {
+    return rounded_size / alignof(max_align_t) - 1;
+}
+
+static struct arena_shard *lock_shard(struct hash_table_arena *arena) {
+    struct arena_shard *shard = &arena->shards[hash_table_thread_index() % ARENA_SHARDS];
+    int ret = pthread_mutex_lock(&shard->mutex);
+    if (ret != 0) {
+        fprintf(stderr, "Error locking mutex: %d\n", ret);
+        exit(ret);
+    }
+    return shard;
+}
+
+static void unlock_shard(struct arena_shard *shard) {
+    int ret = pthread_mutex_unlock(&shard->mutex);
+    if (ret != 0) {
+        fprintf(stderr, "Error unlocking mutex: %d\n", ret);
+        exit(ret);
+    }
+}
+
+void *hash_table_arena_alloc(struct hash_table_arena *arena, size_t size) {
+    size = round_size(size);
+    struct arena_shard *shard = lock_shard(arena);
+    void *memory;
+    if (has_free_class(size) && shard->free_lists[free_class(size)] != NULL) {
+        struct free_block *block = shard->free_lists[free_class(size)];
+        shard->free_lists[free_class(size)] = block->next;
+        memory = block;
+    } else if (size > SLAB_SIZE) {
+        // Too big to share a slab, so give it one of its own behind the
+        // current slab, which keeps the current slab's remaining space usable
+        if (shard->slabs == NULL) {
+            shard->slabs = alloc_slab(size, NULL);
+            shard->used = size;
+            memory = shard->slabs->data;
+        } else {
+            shard->slabs->next = alloc_slab(size, shard->slabs->next);
+            memory = shard->slabs->next->data;
+        }
+    } else {
+        if (shard->slabs == NULL || shard->used + size > SLAB_SIZE) {
+            shard->slabs = alloc_slab(SLAB_SIZE, shard->slabs);
+            shard->used = 0;
+        }
+        memory = shard->slabs->data + shard->used;
+        shard->used += size;
+    }
+    unlock_shard(shard);
+    return memory;
+}
+
+void hash_table_arena_free(struct hash_table_arena *arena, void *memory, size_t size) {
+    size = round_size(size);
+    if (!has_free_class(size)) {
+        return; // rare enough to just hold on to until destroy
+    }
+    struct arena_shard *shard = lock_shard(arena);
+    struct free_block *block = memory;
+    block->next = shard->free_lists[free_class(size)];
+    shard->free_lists[free_class(size)] = block;
+    unlock_shard(shard);
+}
+
+void hash_table_arena_destroy(struct hash_table_arena *arena) {
+    for (size_t i = 0; i < ARENA_SHARDS; ++i) {
+        struct slab *slab = arena->shards[i].slabs;
+        while (slab != NULL) {
+            struct slab *next = slab->next;
+            free(slab);
+            slab = next;
+        }
+        pthread_mutex_destroy(&arena->shards[i].mutex);
+    }
+    free(arena);
+}
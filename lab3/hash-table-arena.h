@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stddef.h>
+
+/* Bump allocator for table nodes. Each thread carves its allocations out
+   of its own slabs, and every slab is released at once on destroy. */
+struct hash_table_arena;
+struct hash_table_arena *hash_table_arena_create();
+void *hash_table_arena_alloc(struct hash_table_arena *arena, size_t size);
+/* Hands back memory from hash_table_arena_alloc of the same size, which
+   the calling thread's later allocations of that size will reuse */
+void hash_table_arena_free(struct hash_table_arena *arena, void *memory, size_t size);
+void hash_table_arena_destroy(struct hash_table_arena *arena);
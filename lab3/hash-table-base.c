@@ -36,7 +36,7 @@ static struct hash_table_entry *get_hash_table_entry(struct hash_table_base *has
                                                      const char *key)
 {
 	assert(key != NULL);
-	uint32_t index = bernstein_hash(key) % HASH_TABLE_CAPACITY;
+	uint32_t index = hash_table_hash(key) % HASH_TABLE_CAPACITY;
 	struct hash_table_entry *entry = &hash_table->entries[index];
 	return entry;
 }
@@ -1,7 +1,9 @@
 #include "hash-table-common.h"
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <string.h>
 
 uint32_t bernstein_hash(const char *string)
 {
@@ -17,3 +19,134 @@ uint32_t bernstein_hash(const char *string)
 	}
 	return hash;
 }
+
+uint32_t fnv1a_hash(const char *string)
+{
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; string[i] != 0; ++i) {
+		hash ^= (uint8_t) string[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static inline uint64_t read_u64(const char *p)
+{
+	uint64_t word;
+	memcpy(&word, p, sizeof(word));
+	return word;
+}
+
+/* Reads the last `length` (at most 8) bytes of a string as one word */
+static inline uint64_t read_tail(const char *p, size_t length)
+{
+	uint64_t word = 0;
+	memcpy(&word, p, length);
+	return word;
+}
+
+/* Word-at-a-time variant of MurmurHash64A */
+uint32_t murmur64_hash(const char *string)
+{
+	const uint64_t m = 0xc6a4a7935bd1e995ull;
+	size_t length = strlen(string);
+	uint64_t hash = 0x8445d61a4e774912ull ^ (length * m);
+	size_t i = 0;
+	for (; i + 8 <= length; i += 8) {
+		uint64_t k = read_u64(string + i);
+		k *= m;
+		k ^= k >> 47;
+		k *= m;
+		hash ^= k;
+		hash *= m;
+	}
+	if (i < length) {
+		hash ^= read_tail(string + i, length - i);
+		hash *= m;
+	}
+	hash ^= hash >> 47;
+	hash *= m;
+	hash ^= hash >> 47;
+	return (uint32_t) hash;
+}
+
+static inline uint64_t wy_mix(uint64_t a, uint64_t b)
+{
+	__uint128_t product = (__uint128_t) a * b;
+	return (uint64_t) product ^ (uint64_t) (product >> 64);
+}
+
+/* wyhash-style: 16 bytes per 64x64->128 bit multiply */
+uint32_t wy_hash(const char *string)
+{
+	const uint64_t s0 = 0xa0761d6478bd642full;
+	const uint64_t s1 = 0xe7037ed1a0b428dbull;
+	const uint64_t s2 = 0x8ebc6af09c88c6e3ull;
+	size_t length = strlen(string);
+	uint64_t seed = s0 ^ length;
+	uint64_t a, b;
+	if (length == 7) {
+		/* The tester's keys: the terminator makes this one full word */
+		a = read_u64(string);
+		b = 0;
+	}
+	else if (length <= 8) {
+		a = read_tail(string, length);
+		b = 0;
+	}
+	else if (length <= 16) {
+		a = read_u64(string);
+		b = read_tail(string + 8, length - 8);
+	}
+	else {
+		size_t i = 0;
+		for (; length - i > 16; i += 16) {
+			seed = wy_mix(read_u64(string + i) ^ s1, read_u64(string + i + 8) ^ seed);
+		}
+		a = read_u64(string + length - 16);
+		b = read_u64(string + length - 8);
+	}
+	return (uint32_t) wy_mix(s2 ^ length, wy_mix(a ^ s1, b ^ seed));
+}
+
+const struct hash_function hash_functions[] = {
+	{ "bernstein", bernstein_hash },
+	{ "fnv1a", fnv1a_hash },
+	{ "murmur64", murmur64_hash },
+	{ "wyhash", wy_hash },
+};
+
+const size_t hash_function_count = sizeof(hash_functions) / sizeof(hash_functions[0]);
+
+const struct hash_function *hash_function_find(const char *name)
+{
+	for (size_t i = 0; i < hash_function_count; ++i) {
+		if (strcmp(hash_functions[i].name, name) == 0) {
+			return &hash_functions[i];
+		}
+	}
+	return NULL;
+}
+
+static uint32_t (*current_hash)(const char *string) = bernstein_hash;
+
+void hash_table_set_hash_function(const struct hash_function *function)
+{
+	current_hash = function->hash;
+}
+
+uint32_t hash_table_hash(const char *string)
+{
+	return current_hash(string);
+}
+
+static atomic_uint next_thread_index;
+static __thread uint32_t thread_index_plus_one;
+
+uint32_t hash_table_thread_index(void)
+{
+	if (thread_index_plus_one == 0) {
+		thread_index_plus_one = atomic_fetch_add(&next_thread_index, 1) + 1;
+	}
+	return thread_index_plus_one - 1;
+}
@@ -1,7 +1,30 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define HASH_TABLE_CAPACITY 4096
 
 uint32_t bernstein_hash(const char *string);
+uint32_t fnv1a_hash(const char *string);
+uint32_t murmur64_hash(const char *string);
+uint32_t wy_hash(const char *string);
+
+struct hash_function {
+	const char *name;
+	uint32_t (*hash)(const char *string);
+};
+
+extern const struct hash_function hash_functions[];
+extern const size_t hash_function_count;
+
+/* Returns the named hash function, or NULL if there is none */
+const struct hash_function *hash_function_find(const char *name);
+
+/* Every table hashes keys through hash_table_hash, which defaults to
+   bernstein_hash. Only switch functions while no table holds entries. */
+void hash_table_set_hash_function(const struct hash_function *function);
+uint32_t hash_table_hash(const char *string);
+
+/* A small, dense index for the calling thread, assigned on first use */
+uint32_t hash_table_thread_index(void);
@@ -0,0 +1,517 @@
+#include "hash-table-cuckoo.h"
+
+#include "hash-table-epoch.h"
+
+#include <assert.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every key has two candidate buckets of SLOTS_PER_BUCKET slots each, and
+// sits in one of them. When both are full, an insert searches breadth-first
+// for the shortest chain of entries that can each hop to their other bucket
+// and end in a free slot, then moves them back to front so a slot opens up
+// in one of the key's buckets. Only when no such chain exists does the
+// table double.
+//
+// Buckets are guarded by LOCK_COUNT striped locks, each of which is also a
+// version counter: odd while a writer holds it. Lookups never lock. They
+// read both stripes' versions, search the two buckets, and retry if either
+// version moved meanwhile (MemC3 and libcuckoo work the same way).
+
+#define SLOTS_PER_BUCKET 4
+#define LOCK_COUNT 1024       // a power of two, at most the initial bucket count
+#define MAX_BFS_DEPTH 5       // longest displacement chain an insert will try
+#define MAX_BFS_NODES 256     // buckets a single search may visit
+#define SPINS_BEFORE_YIELD 64
+#define CACHE_LINE_SIZE 64
+
+struct slot {
+    _Atomic(const char *) key; // NULL when the slot is free
+    _Atomic uint32_t hash;
+    _Atomic uint32_t value;
+};
+
+struct bucket {
+    struct slot slots[SLOTS_PER_BUCKET];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct bucket_array {
+    size_t mask; // number of buckets - 1
+    struct bucket *buckets;
+};
+
+struct stripe {
+    atomic_uint_fast64_t version;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct hash_table_cuckoo {
+    _Atomic(struct bucket_array *) array;
+    struct stripe stripes[LOCK_COUNT];
+    struct hash_table_limbo *limbo; // removed keys and outgrown arrays
+};
+
+// A displacement chain: the entry in slots[i] of buckets[i] moves to
+// buckets[i + 1], and buckets[length] has a free slot.
+struct cuckoo_path {
+    size_t buckets[MAX_BFS_DEPTH + 1];
+    unsigned slots[MAX_BFS_DEPTH];
+    size_t length;
+};
+
+_Static_assert(sizeof(struct bucket) == CACHE_LINE_SIZE, "a bucket should fill one cache line");
+_Static_assert((HASH_TABLE_CAPACITY & (HASH_TABLE_CAPACITY - 1)) == 0,
+               "HASH_TABLE_CAPACITY must be a power of two");
+_Static_assert(LOCK_COUNT <= HASH_TABLE_CAPACITY, "stripes must not outnumber buckets");
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
+// The murmur3 finalizer, since the default bernstein_hash mixes poorly
+static inline uint64_t mix_hash(uint32_t hash) {
+    uint64_t x = hash;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+// The second bucket is the first XORed with an offset drawn from the hash,
+// so either bucket leads to the other without the key. Both bucket numbers
+// agree with the mixed hash on their low bits, which is what lets a lookup
+// pick its stripes before it knows the table's size.
+static inline uint64_t alt_offset(uint64_t mixed) {
+    return (mixed >> 32) * 0xc6a4a7935bd1e995ull;
+}
+
+static inline size_t alt_bucket(size_t bucket, uint32_t hash, size_t mask) {
+    return (bucket ^ alt_offset(mix_hash(hash))) & mask;
+}
+
+static inline struct stripe *bucket_stripe(struct hash_table_cuckoo *hash_table, size_t bucket) {
+    return &hash_table->stripes[bucket & (LOCK_COUNT - 1)];
+}
+
+static void lock_stripe(struct stripe *stripe) {
+    unsigned spins = 0;
+    while (true) {
+        uint_fast64_t version = atomic_load_explicit(&stripe->version, memory_order_relaxed);
+        if ((version & 1) == 0
+            && atomic_compare_exchange_weak_explicit(&stripe->version, &version, version + 1,
+                                                     memory_order_acquire, memory_order_relaxed)) {
+            // The CAS only orders what follows it against loads. The slot
+            // stores that follow are relaxed, so without this fence a reader
+            // could see them before the odd version and validate a torn read.
+            atomic_thread_fence(memory_order_release);
+            return;
+        }
+        // With more threads than cores the holder may not even be running
+        if (++spins < SPINS_BEFORE_YIELD) {
+            cpu_relax();
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+static void unlock_stripe(struct stripe *stripe) {
+    atomic_fetch_add_explicit(&stripe->version, 1, memory_order_release);
+}
+
+// Locks in address order, so two writers never wait on each other's second lock
+static void lock_pair(struct stripe *first, struct stripe *second) {
+    if (first > second) {
+        struct stripe *swap = first;
+        first = second;
+        second = swap;
+    }
+    lock_stripe(first);
+    if (second != first) {
+        lock_stripe(second);
+    }
+}
+
+static void unlock_pair(struct stripe *first, struct stripe *second) {
+    unlock_stripe(first);
+    if (second != first) {
+        unlock_stripe(second);
+    }
+}
+
+// Waits out any writer and returns the even version a read starts from
+static uint_fast64_t read_begin(struct stripe *stripe) {
+    unsigned spins = 0;
+    uint_fast64_t version;
+    while ((version = atomic_load_explicit(&stripe->version, memory_order_acquire)) & 1) {
+        if (++spins < SPINS_BEFORE_YIELD) {
+            cpu_relax();
+        } else {
+            sched_yield();
+        }
+    }
+    return version;
+}
+
+static struct bucket_array *alloc_bucket_array(size_t bucket_count) {
+    struct bucket_array *array = malloc(sizeof(struct bucket_array));
+    struct bucket *buckets = aligned_alloc(CACHE_LINE_SIZE, bucket_count * sizeof(struct bucket));
+    if (array == NULL || buckets == NULL) {
+        fprintf(stderr, "Failed to allocate memory for hash table buckets\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < bucket_count; ++i) {
+        for (size_t j = 0; j < SLOTS_PER_BUCKET; ++j) {
+            atomic_init(&buckets[i].slots[j].key, NULL);
+            atomic_init(&buckets[i].slots[j].hash, 0);
+            atomic_init(&buckets[i].slots[j].value, 0);
+        }
+    }
+    array->mask = bucket_count - 1;
+    array->buckets = buckets;
+    return array;
+}
+
+static void free_bucket_array(struct bucket_array *array) {
+    free(array->buckets);
+    free(array);
+}
+
+// Keys and bucket arrays both come back through the limbo, told apart by tag:
+// arrays are retired with their lowest bit set.
+static void reclaim(void *context, void *node) {
+    (void)context;
+    if ((uintptr_t)node & 1) {
+        free_bucket_array((struct bucket_array *)((uintptr_t)node & ~(uintptr_t)1));
+    } else {
+        free(node);
+    }
+}
+
+struct hash_table_cuckoo *hash_table_cuckoo_create() {
+    struct hash_table_cuckoo *hash_table = aligned_alloc(CACHE_LINE_SIZE, sizeof(struct hash_table_cuckoo));
+    if (hash_table == NULL) {
+        fprintf(stderr, "Failed to allocate memory for hash table\n");
+        exit(EXIT_FAILURE);
+    }
+    atomic_init(&hash_table->array, alloc_bucket_array(HASH_TABLE_CAPACITY));
+    for (size_t i = 0; i < LOCK_COUNT; ++i) {
+        atomic_init(&hash_table->stripes[i].version, 0);
+    }
+    hash_table->limbo = hash_table_limbo_create(reclaim, NULL);
+    return hash_table;
+}
+
+void hash_table_cuckoo_destroy(struct hash_table_cuckoo *hash_table) {
+    struct bucket_array *array = atomic_load_explicit(&hash_table->array, memory_order_relaxed);
+    for (size_t i = 0; i <= array->mask; ++i) {
+        for (size_t j = 0; j < SLOTS_PER_BUCKET; ++j) {
+            free((void*)atomic_load_explicit(&array->buckets[i].slots[j].key, memory_order_relaxed));
+        }
+    }
+    free_bucket_array(array);
+    hash_table_limbo_destroy(hash_table->limbo);
+    free(hash_table);
+}
+
+static struct slot *find_slot(struct bucket *bucket, uint32_t hash, const char *key) {
+    for (size_t i = 0; i < SLOTS_PER_BUCKET; ++i) {
+        struct slot *slot = &bucket->slots[i];
+        if (atomic_load_explicit(&slot->hash, memory_order_relaxed) != hash) {
+            continue;
+        }
+        const char *slot_key = atomic_load_explicit(&slot->key, memory_order_relaxed);
+        if (slot_key != NULL && strcmp(slot_key, key) == 0) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+static struct slot *find_free_slot(struct bucket *bucket) {
+    for (size_t i = 0; i < SLOTS_PER_BUCKET; ++i) {
+        if (atomic_load_explicit(&bucket->slots[i].key, memory_order_relaxed) == NULL) {
+            return &bucket->slots[i];
+        }
+    }
+    return NULL;
+}
+
+static void fill_slot(struct slot *slot, const char *key, uint32_t hash, uint32_t value) {
+    atomic_store_explicit(&slot->hash, hash, memory_order_relaxed);
+    atomic_store_explicit(&slot->value, value, memory_order_relaxed);
+    atomic_store_explicit(&slot->key, key, memory_order_relaxed);
+}
+
+// Breadth-first from both of a key's buckets, so the chain found is the
+// shortest one. Against a live table the slots may change under the search;
+// move_path checks every hop again under its locks.
+static bool search_path(struct bucket_array *array, size_t first, size_t second,
+                        struct cuckoo_path *path) {
+    struct {
+        size_t bucket;
+        int parent;     // index of the node this one was reached from, or -1
+        unsigned slot;  // slot in the parent's bucket whose entry moves here
+        unsigned depth;
+    } nodes[MAX_BFS_NODES];
+    size_t tail = 0;
+    nodes[tail++] = (typeof(nodes[0])){ first, -1, 0, 0 };
+    if (second != first) {
+        nodes[tail++] = (typeof(nodes[0])){ second, -1, 0, 0 };
+    }
+    for (size_t head = 0; head < tail; ++head) {
+        struct bucket *bucket = &array->buckets[nodes[head].bucket];
+        if (find_free_slot(bucket) != NULL) {
+            size_t length = nodes[head].depth;
+            path->length = length;
+            for (int node = (int)head; node >= 0; node = nodes[node].parent) {
+                path->buckets[nodes[node].depth] = nodes[node].bucket;
+                if (nodes[node].depth > 0) {
+                    path->slots[nodes[node].depth - 1] = nodes[node].slot;
+                }
+            }
+            return true;
+        }
+        if (nodes[head].depth == MAX_BFS_DEPTH) {
+            continue;
+        }
+        for (unsigned i = 0; i < SLOTS_PER_BUCKET && tail < MAX_BFS_NODES; ++i) {
+            uint32_t hash = atomic_load_explicit(&bucket->slots[i].hash, memory_order_relaxed);
+            nodes[tail++] = (typeof(nodes[0])){
+                alt_bucket(nodes[head].bucket, hash, array->mask), head, i, nodes[head].depth + 1 };
+        }
+    }
+    return false;
+}
+
+// Moves the chain's entries back to front, each into its other bucket, which
+// frees a slot in path->buckets[0]. hash_table is NULL for an array no other
+// thread can see yet, which needs no locks. Returns false if a hop no longer
+// fits because other writers got there first.
+static bool move_path(struct hash_table_cuckoo *hash_table, struct bucket_array *array,
+                      const struct cuckoo_path *path) {
+    for (size_t i = path->length; i-- > 0;) {
+        size_t from = path->buckets[i];
+        size_t to = path->buckets[i + 1];
+        struct stripe *from_stripe = NULL;
+        struct stripe *to_stripe = NULL;
+        if (hash_table != NULL) {
+            from_stripe = bucket_stripe(hash_table, from);
+            to_stripe = bucket_stripe(hash_table, to);
+            lock_pair(from_stripe, to_stripe);
+            if (atomic_load_explicit(&hash_table->array, memory_order_relaxed) != array) {
+                unlock_pair(from_stripe, to_stripe);
+                return false;
+            }
+        }
+        struct slot *source = &array->buckets[from].slots[path->slots[i]];
+        const char *key = atomic_load_explicit(&source->key, memory_order_relaxed);
+        uint32_t hash = atomic_load_explicit(&source->hash, memory_order_relaxed);
+        struct slot *target = find_free_slot(&array->buckets[to]);
+        bool moved = key != NULL && target != NULL && alt_bucket(from, hash, array->mask) == to;
+        if (moved) {
+            // Both buckets' stripes are held, so a lookup that sees the entry
+            // in neither, or in both, will retry
+            fill_slot(target, key, hash, atomic_load_explicit(&source->value, memory_order_relaxed));
+            atomic_store_explicit(&source->key, NULL, memory_order_relaxed);
+        }
+        if (hash_table != NULL) {
+            unlock_pair(from_stripe, to_stripe);
+        }
+        if (!moved) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Places an entry into an array no other thread can see yet
+static bool insert_private(struct bucket_array *array, const char *key, uint32_t hash, uint32_t value) {
+    size_t first = mix_hash(hash) & array->mask;
+    size_t second = alt_bucket(first, hash, array->mask);
+    struct cuckoo_path path;
+    while (true) {
+        struct slot *slot = find_free_slot(&array->buckets[first]);
+        if (slot == NULL) {
+            slot = find_free_slot(&array->buckets[second]);
+        }
+        if (slot != NULL) {
+            fill_slot(slot, key, hash, value);
+            return true;
+        }
+        if (!search_path(array, first, second, &path)) {
+            return false;
+        }
+        move_path(NULL, array, &path);
+    }
+}
+
+// Doubles the table (or more, if some entry still has no room) while holding
+// every stripe. Does nothing if another writer already replaced array.
+static void grow(struct hash_table_cuckoo *hash_table, struct bucket_array *array) {
+    for (size_t i = 0; i < LOCK_COUNT; ++i) {
+        lock_stripe(&hash_table->stripes[i]);
+    }
+    if (atomic_load_explicit(&hash_table->array, memory_order_relaxed) == array) {
+        struct bucket_array *grown = NULL;
+        for (size_t count = (array->mask + 1) * 2; grown == NULL; count *= 2) {
+            grown = alloc_bucket_array(count);
+            for (size_t i = 0; i <= array->mask && grown != NULL; ++i) {
+                for (size_t j = 0; j < SLOTS_PER_BUCKET; ++j) {
+                    struct slot *slot = &array->buckets[i].slots[j];
+                    const char *key = atomic_load_explicit(&slot->key, memory_order_relaxed);
+                    if (key != NULL
+                        && !insert_private(grown,
+                                           key,
+                                           atomic_load_explicit(&slot->hash, memory_order_relaxed),
+                                           atomic_load_explicit(&slot->value, memory_order_relaxed))) {
+                        free_bucket_array(grown);
+                        grown = NULL;
+                        break;
+                    }
+                }
+            }
+        }
+        atomic_store_explicit(&hash_table->array, grown, memory_order_release);
+        // Lookups that loaded the old array may still be reading it
+        hash_table_limbo_retire(hash_table->limbo, (void *)((uintptr_t)array | 1));
+    }
+    for (size_t i = LOCK_COUNT; i-- > 0;) {
+        unlock_stripe(&hash_table->stripes[i]);
+    }
+}
+
+void hash_table_cuckoo_add_entry(struct hash_table_cuckoo *hash_table, const char *key, uint32_t value) {
+    assert(key != NULL);
+    uint32_t hash = hash_table_hash(key);
+    uint64_t mixed = mix_hash(hash);
+    struct stripe *first_stripe = bucket_stripe(hash_table, mixed);
+    struct stripe *second_stripe = bucket_stripe(hash_table, mixed ^ alt_offset(mixed));
+    char *dup_key = strdup(key);
+    if (dup_key == NULL) {
+        fprintf(stderr, "Failed to duplicate key\n");
+        exit(EXIT_FAILURE);
+    }
+
+    while (true) {
+        // Pinned before the array is loaded, so that a grow by another writer
+        // cannot reclaim it while we search and move through it unlocked
+        hash_table_epoch_enter();
+        lock_pair(first_stripe, second_stripe);
+        // grow holds every stripe, so the array cannot change under us
+        struct bucket_array *array = atomic_load_explicit(&hash_table->array, memory_order_relaxed);
+        size_t first = mixed & array->mask;
+        size_t second = alt_bucket(first, hash, array->mask);
+
+        struct slot *slot = find_slot(&array->buckets[first], hash, key);
+        if (slot == NULL) {
+            slot = find_slot(&array->buckets[second], hash, key);
+        }
+        if (slot != NULL) { // Key found, update the value
+            atomic_store_explicit(&slot->value, value, memory_order_relaxed);
+            unlock_pair(first_stripe, second_stripe);
+            hash_table_epoch_exit();
+            free(dup_key);
+            return;
+        }
+        slot = find_free_slot(&array->buckets[first]);
+        if (slot == NULL) {
+            slot = find_free_slot(&array->buckets[second]);
+        }
+        if (slot != NULL) {
+            fill_slot(slot, dup_key, hash, value);
+            unlock_pair(first_stripe, second_stripe);
+            hash_table_epoch_exit();
+            return;
+        }
+        unlock_pair(first_stripe, second_stripe);
+
+        // Both buckets are full: make room and try again
+        struct cuckoo_path path;
+        if (search_path(array, first, second, &path)) {
+            move_path(hash_table, array, &path);
+        } else {
+            grow(hash_table, array);
+        }
+        hash_table_epoch_exit();
+    }
+}
+
+static bool lookup(struct hash_table_cuckoo *hash_table, const char *key, uint32_t *value) {
+    assert(key != NULL);
+    uint32_t hash = hash_table_hash(key);
+    uint64_t mixed = mix_hash(hash);
+    struct stripe *first_stripe = bucket_stripe(hash_table, mixed);
+    struct stripe *second_stripe = bucket_stripe(hash_table, mixed ^ alt_offset(mixed));
+    bool found;
+    hash_table_epoch_enter();
+    while (true) {
+        uint_fast64_t first_version = read_begin(first_stripe);
+        uint_fast64_t second_version = read_begin(second_stripe);
+        // Loaded after the versions: an array grown since then changes them
+        struct bucket_array *array = atomic_load_explicit(&hash_table->array, memory_order_acquire);
+        size_t first = mixed & array->mask;
+        struct slot *slot = find_slot(&array->buckets[first], hash, key);
+        if (slot == NULL) {
+            slot = find_slot(&array->buckets[alt_bucket(first, hash, array->mask)], hash, key);
+        }
+        found = slot != NULL;
+        if (found && value != NULL) {
+            *value = atomic_load_explicit(&slot->value, memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&first_stripe->version, memory_order_relaxed) == first_version
+            && atomic_load_explicit(&second_stripe->version, memory_order_relaxed) == second_version) {
+            break;
+        }
+    }
+    hash_table_epoch_exit();
+    return found;
+}
+
+bool hash_table_cuckoo_contains(struct hash_table_cuckoo *hash_table, const char *key) {
+    return lookup(hash_table, key, NULL);
+}
+
+uint32_t hash_table_cuckoo_get_value(struct hash_table_cuckoo *hash_table, const char *key) {
+    uint32_t value = 0;
+    bool found = lookup(hash_table, key, &value);
+    assert(found);
+    (void)found;
+    return value;
+}
+
+bool hash_table_cuckoo_remove(struct hash_table_cuckoo *hash_table, const char *key) {
+    assert(key != NULL);
+    uint32_t hash = hash_table_hash(key);
+    uint64_t mixed = mix_hash(hash);
+    struct stripe *first_stripe = bucket_stripe(hash_table, mixed);
+    struct stripe *second_stripe = bucket_stripe(hash_table, mixed ^ alt_offset(mixed));
+    lock_pair(first_stripe, second_stripe);
+    struct bucket_array *array = atomic_load_explicit(&hash_table->array, memory_order_relaxed);
+    size_t first = mixed & array->mask;
+    struct slot *slot = find_slot(&array->buckets[first], hash, key);
+    if (slot == NULL) {
+        slot = find_slot(&array->buckets[alt_bucket(first, hash, array->mask)], hash, key);
+    }
+    const char *removed = NULL;
+    if (slot != NULL) {
+        removed = atomic_load_explicit(&slot->key, memory_order_relaxed);
+        atomic_store_explicit(&slot->key, NULL, memory_order_relaxed);
+    }
+    unlock_pair(first_stripe, second_stripe);
+    if (removed == NULL) {
+        return false;
+    }
+    // A lookup may still be comparing against the key
+    hash_table_limbo_retire(hash_table->limbo, (void *)removed);
+    return true;
+}
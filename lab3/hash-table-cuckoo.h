@@ -0,0 +1,21 @@
+#pragma once
+
+#include "hash-table-common.h"
+
+#include <stdbool.h>
+
+/* Bucketized cuckoo hashing: every key lives in one of two 4-slot buckets,
+   so a lookup reads at most two cache lines however keys collide.
+   Lookups take no locks; they retry if a writer changed either bucket. */
+struct hash_table_cuckoo;
+struct hash_table_cuckoo *hash_table_cuckoo_create();
+void hash_table_cuckoo_add_entry(struct hash_table_cuckoo *hash_table,
+                                 const char *key,
+                                 uint32_t value);
+bool hash_table_cuckoo_contains(struct hash_table_cuckoo *hash_table,
+                                const char *key);
+uint32_t hash_table_cuckoo_get_value(struct hash_table_cuckoo *hash_table,
+                                     const char* key);
+bool hash_table_cuckoo_remove(struct hash_table_cuckoo *hash_table,
+                              const char *key);
+void hash_table_cuckoo_destroy(struct hash_table_cuckoo *hash_table);
@@ -0,0 +1,234 @@
+#include "hash-table-epoch.h"
+#include "hash-table-common.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <pthread.h>
+
+// The global epoch only advances once every pinned thread has seen its
+// current value. A node retired in epoch e may still be reached by readers
+// pinned in e - 1 or e, but once the epoch reaches e + 2 all of those have
+// unpinned, so it is safe to reclaim. Each limbo shard therefore only ever
+// needs three bags of retired nodes, one per epoch modulo 3.
+
+#define EPOCH_BAGS 3
+#define LIMBO_SHARDS 64   // threads beyond this share a shard, behind its mutex
+#define RECLAIM_BATCH 64  // retirements between attempts to advance the epoch
+#define CACHE_LINE_SIZE 64
+
+struct epoch_record {
+    atomic_uint_least64_t state; // (epoch << 1) | 1 while pinned, 0 otherwise
+    unsigned nesting;            // only touched by the owning thread
+    atomic_bool in_use;
+    struct epoch_record *next;   // never changes once the record is listed
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct limbo_bag {
+    uint64_t epoch;
+    void **nodes;
+    size_t count;
+    size_t capacity;
+};
+
+struct limbo_shard {
+    pthread_mutex_t mutex;
+    struct limbo_bag bags[EPOCH_BAGS];
+    size_t retired; // since the last attempt to advance the epoch
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct hash_table_limbo {
+    void (*reclaim)(void *context, void *node);
+    void *context;
+    struct limbo_shard shards[LIMBO_SHARDS];
+};
+
+static atomic_uint_least64_t global_epoch;
+
+// Threads register a record on first use and hand it back when they exit,
+// so the list only grows to the most threads ever alive at once
+static _Atomic(struct epoch_record *) records;
+static pthread_key_t record_key;
+static pthread_once_t record_key_once = PTHREAD_ONCE_INIT;
+static __thread struct epoch_record *thread_record;
+
+static void release_record(void *arg) {
+    struct epoch_record *record = arg;
+    atomic_store_explicit(&record->state, 0, memory_order_release);
+    atomic_store_explicit(&record->in_use, false, memory_order_release);
+}
+
+static void create_record_key() {
+    int ret = pthread_key_create(&record_key, release_record);
+    if (ret != 0) {
+        fprintf(stderr, "Error creating epoch record key: %d\n", ret);
+        exit(ret);
+    }
+}
+
+static struct epoch_record *register_thread() {
+    pthread_once(&record_key_once, create_record_key);
+
+    struct epoch_record *record = atomic_load_explicit(&records, memory_order_acquire);
+    for (; record != NULL; record = record->next) {
+        bool expected = false;
+        if (!atomic_load_explicit(&record->in_use, memory_order_relaxed)
+            && atomic_compare_exchange_strong_explicit(&record->in_use, &expected, true,
+                                                       memory_order_acquire, memory_order_relaxed)) {
+            break;
+        }
+    }
+    if (record == NULL) {
+        record = aligned_alloc(CACHE_LINE_SIZE, sizeof(struct epoch_record));
+        if (record == NULL) {
+            fprintf(stderr, "Failed to allocate memory for epoch record\n");
+            exit(EXIT_FAILURE);
+        }
+        atomic_init(&record->state, 0);
+        atomic_init(&record->in_use, true);
+        record->next = atomic_load_explicit(&records, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(&records, &record->next, record,
+                                                      memory_order_release, memory_order_relaxed)) {
+        }
+    }
+    record->nesting = 0;
+
+    int ret = pthread_setspecific(record_key, record);
+    if (ret != 0) {
+        fprintf(stderr, "Error registering epoch record: %d\n", ret);
+        exit(ret);
+    }
+    thread_record = record;
+    return record;
+}
+
+void hash_table_epoch_enter(void) {
+    struct epoch_record *record = thread_record != NULL ? thread_record : register_thread();
+    if (record->nesting++ == 0) {
+        uint64_t epoch = atomic_load_explicit(&global_epoch, memory_order_relaxed);
+        atomic_store_explicit(&record->state, (epoch << 1) | 1, memory_order_relaxed);
+        // The pin must be visible before any node is loaded; pairs with
+        // the fence in try_advance
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+}
+
+void hash_table_epoch_exit(void) {
+    struct epoch_record *record = thread_record;
+    if (--record->nesting == 0) {
+        atomic_store_explicit(&record->state, 0, memory_order_release);
+    }
+}
+
+// Moves the global epoch on if every pinned thread has caught up with it,
+// and returns the global epoch as it then stands
+static uint64_t try_advance() {
+    uint64_t epoch = atomic_load_explicit(&global_epoch, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    struct epoch_record *record = atomic_load_explicit(&records, memory_order_acquire);
+    for (; record != NULL; record = record->next) {
+        // Acquire, so everything a reader did before unpinning happens
+        // before whatever is reclaimed once the epoch moves on
+        uint64_t state = atomic_load_explicit(&record->state, memory_order_acquire);
+        if ((state & 1) && (state >> 1) != epoch) {
+            return epoch;
+        }
+    }
+    if (atomic_compare_exchange_strong_explicit(&global_epoch, &epoch, epoch + 1,
+                                                memory_order_acq_rel, memory_order_acquire)) {
+        return epoch + 1;
+    }
+    return epoch; // another thread advanced it first
+}
+
+struct hash_table_limbo *hash_table_limbo_create(void (*reclaim)(void *context, void *node), void *context) {
+    struct hash_table_limbo *limbo = aligned_alloc(CACHE_LINE_SIZE, sizeof(struct hash_table_limbo));
+    if (limbo == NULL) {
+        fprintf(stderr, "Failed to allocate memory for limbo\n");
+        exit(EXIT_FAILURE);
+    }
+    limbo->reclaim = reclaim;
+    limbo->context = context;
+    for (size_t i = 0; i < LIMBO_SHARDS; ++i) {
+        struct limbo_shard *shard = &limbo->shards[i];
+        for (size_t b = 0; b < EPOCH_BAGS; ++b) {
+            shard->bags[b] = (struct limbo_bag){ 0 };
+        }
+        shard->retired = 0;
+        int ret = pthread_mutex_init(&shard->mutex, NULL);
+        if (ret != 0) {
+            fprintf(stderr, "Error initializing mutex: %d\n", ret);
+            exit(ret);
+        }
+    }
+    return limbo;
+}
+
+static void reclaim_bag(struct hash_table_limbo *limbo, struct limbo_bag *bag) {
+    for (size_t i = 0; i < bag->count; ++i) {
+        limbo->reclaim(limbo->context, bag->nodes[i]);
+    }
+    bag->count = 0;
+}
+
+void hash_table_limbo_retire(struct hash_table_limbo *limbo, void *node) {
+    struct limbo_shard *shard = &limbo->shards[hash_table_thread_index() % LIMBO_SHARDS];
+    int ret = pthread_mutex_lock(&shard->mutex);
+    if (ret != 0) {
+        fprintf(stderr, "Error locking mutex: %d\n", ret);
+        exit(ret);
+    }
+
+    // Read the epoch only after the caller's unlink is visible, so no
+    // reader pinned in a later epoch can still find the node. Reading it
+    // under the shard mutex also keeps a shared shard's bags in epoch order.
+    atomic_thread_fence(memory_order_seq_cst);
+    uint64_t epoch = atomic_load_explicit(&global_epoch, memory_order_acquire);
+
+    struct limbo_bag *bag = &shard->bags[epoch % EPOCH_BAGS];
+    if (bag->epoch != epoch) {
+        // Left over from epoch - 3 or earlier, so long since safe
+        reclaim_bag(limbo, bag);
+        bag->epoch = epoch;
+    }
+    if (bag->count == bag->capacity) {
+        bag->capacity = bag->capacity == 0 ? RECLAIM_BATCH : bag->capacity * 2;
+        bag->nodes = realloc(bag->nodes, bag->capacity * sizeof(void *));
+        if (bag->nodes == NULL) {
+            fprintf(stderr, "Failed to allocate memory for limbo bag\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    bag->nodes[bag->count++] = node;
+
+    if (++shard->retired >= RECLAIM_BATCH) {
+        shard->retired = 0;
+        epoch = try_advance();
+        for (size_t b = 0; b < EPOCH_BAGS; ++b) {
+            if (shard->bags[b].count > 0 && shard->bags[b].epoch + 2 <= epoch) {
+                reclaim_bag(limbo, &shard->bags[b]);
+            }
+        }
+    }
+
+    ret = pthread_mutex_unlock(&shard->mutex);
+    if (ret != 0) {
+        fprintf(stderr, "Error unlocking mutex: %d\n", ret);
+        exit(ret);
+    }
+}
+
+void hash_table_limbo_destroy(struct hash_table_limbo *limbo) {
+    for (size_t i = 0; i < LIMBO_SHARDS; ++i) {
+        struct limbo_shard *shard = &limbo->shards[i];
+        for (size_t b = 0; b < EPOCH_BAGS; ++b) {
+            reclaim_bag(limbo, &shard->bags[b]);
+            free(shard->bags[b].nodes);
+        }
+        pthread_mutex_destroy(&shard->mutex);
+    }
+    free(limbo);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+/* Epoch-based reclamation. Lock-free readers pin the current epoch while
+   they hold pointers to shared nodes. A node that a writer unlinks is
+   retired, and only reclaimed once every reader that could still see it
+   has unpinned. Pins nest, and cost no more than a store and a fence. */
+void hash_table_epoch_enter(void);
+void hash_table_epoch_exit(void);
+
+/* Holds one table's retired nodes until no reader can still reach them,
+   then hands them to reclaim in batches, from a later retire call */
+struct hash_table_limbo;
+struct hash_table_limbo *hash_table_limbo_create(void (*reclaim)(void *context, void *node),
+                                                 void *context);
+/* The node must already be unreachable for readers that pin after this call */
+void hash_table_limbo_retire(struct hash_table_limbo *limbo, void *node);
+/* Reclaims every retired node; no thread may still be using the table */
+void hash_table_limbo_destroy(struct hash_table_limbo *limbo);
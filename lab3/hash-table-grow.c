@@ -0,0 +1,320 @@
+#include "hash-table-grow.h"
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+
+#include <pthread.h>
+
+// Number of locks guarding the buckets. Bucket i is guarded by stripe
+// i % LOCK_STRIPES no matter how large the table has grown, which works
+// because the capacity is always a power of two and a multiple of this.
+#define LOCK_STRIPES 1024
+#define MAX_LOAD_FACTOR 2 // average entries per bucket before doubling
+#define MIGRATE_PER_OP 2  // old buckets each operation moves during a resize
+#define CACHE_LINE_SIZE 64
+
+struct list_entry {
+    const char *key;
+    uint32_t hash;
+    uint32_t value;
+    SLIST_ENTRY(list_entry) pointers;
+};
+
+SLIST_HEAD(list_head, list_entry);
+
+struct hash_table_entry {
+    struct list_head list_head;
+    bool migrated; // only used in the old array while resizing
+};
+
+struct lock_stripe {
+    pthread_mutex_t mutex;
+    size_t count; // entries living in buckets guarded by this stripe
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct hash_table_grow {
+    struct lock_stripe stripes[LOCK_STRIPES];
+
+    // These only change while every stripe is locked, so holding any one
+    // stripe lock is enough to read them.
+    struct hash_table_entry *entries;
+    size_t capacity;
+    struct hash_table_entry *old_entries; // NULL unless resizing
+    size_t old_capacity;
+
+    // Resize progress, shared by every thread helping with the migration
+    atomic_bool resizing;
+    atomic_size_t next_migration;
+    atomic_size_t migrated;
+};
+
+_Static_assert((HASH_TABLE_CAPACITY & (HASH_TABLE_CAPACITY - 1)) == 0,
+               "HASH_TABLE_CAPACITY must be a power of two");
+_Static_assert(HASH_TABLE_CAPACITY % LOCK_STRIPES == 0,
+               "HASH_TABLE_CAPACITY must be a multiple of LOCK_STRIPES");
+
+static void lock_stripe(struct lock_stripe *stripe) {
+    int ret = pthread_mutex_lock(&stripe->mutex);
+    if (ret != 0) {
+        fprintf(stderr, "Error locking mutex: %d\n", ret);
+        exit(ret);
+    }
+}
+
+static void unlock_stripe(struct lock_stripe *stripe) {
+    int ret = pthread_mutex_unlock(&stripe->mutex);
+    if (ret != 0) {
+        fprintf(stderr, "Error unlocking mutex: %d\n", ret);
+        exit(ret);
+    }
+}
+
+static void lock_all_stripes(struct hash_table_grow *hash_table) {
+    for (size_t i = 0; i < LOCK_STRIPES; ++i) {
+        lock_stripe(&hash_table->stripes[i]);
+    }
+}
+
+static void unlock_all_stripes(struct hash_table_grow *hash_table) {
+    for (size_t i = LOCK_STRIPES; i > 0; --i) {
+        unlock_stripe(&hash_table->stripes[i - 1]);
+    }
+}
+
+static struct hash_table_entry *alloc_entries(size_t capacity) {
+    struct hash_table_entry *entries = calloc(capacity, sizeof(struct hash_table_entry));
+    if (entries == NULL) {
+        fprintf(stderr, "Failed to allocate memory for hash table buckets\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < capacity; ++i) {
+        SLIST_INIT(&entries[i].list_head);
+    }
+    return entries;
+}
+
+static void free_entries(struct hash_table_entry *entries, size_t capacity) {
+    for (size_t i = 0; i < capacity; ++i) {
+        struct list_head *list_head = &entries[i].list_head;
+        struct list_entry *entry;
+        while (!SLIST_EMPTY(list_head)) {
+            entry = SLIST_FIRST(list_head);
+            SLIST_REMOVE_HEAD(list_head, pointers);
+            free((void*)entry->key);
+            free(entry);
+        }
+    }
+    free(entries);
+}
+
+struct hash_table_grow *hash_table_grow_create() {
+    struct hash_table_grow *hash_table = aligned_alloc(CACHE_LINE_SIZE, sizeof(struct hash_table_grow));
+    if (hash_table == NULL) {
+        fprintf(stderr, "Failed to allocate memory for hash table\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(hash_table, 0, sizeof(struct hash_table_grow));
+
+    for (size_t i = 0; i < LOCK_STRIPES; ++i) {
+        int ret = pthread_mutex_init(&hash_table->stripes[i].mutex, NULL);
+        if (ret != 0) {
+            for (size_t j = 0; j < i; ++j) {
+                pthread_mutex_destroy(&hash_table->stripes[j].mutex);
+            }
+            free(hash_table);
+            fprintf(stderr, "Error initializing mutex: %d\n", ret);
+            exit(ret);
+        }
+    }
+    hash_table->entries = alloc_entries(HASH_TABLE_CAPACITY);
+    hash_table->capacity = HASH_TABLE_CAPACITY;
+    atomic_init(&hash_table->resizing, false);
+    atomic_init(&hash_table->next_migration, 0);
+    atomic_init(&hash_table->migrated, 0);
+    return hash_table;
+}
+
+void hash_table_grow_destroy(struct hash_table_grow *hash_table) {
+    if (hash_table->old_entries != NULL) {
+        free_entries(hash_table->old_entries, hash_table->old_capacity);
+    }
+    free_entries(hash_table->entries, hash_table->capacity);
+    for (size_t i = 0; i < LOCK_STRIPES; ++i) {
+        pthread_mutex_destroy(&hash_table->stripes[i].mutex);
+    }
+    free(hash_table);
+}
+
+// Moves every entry of an old bucket into the new array. The caller holds
+// the bucket's stripe lock, which also guards both buckets it splits into.
+// Returns true if this was the last bucket left to move.
+static bool migrate_bucket(struct hash_table_grow *hash_table, struct hash_table_entry *old) {
+    struct list_entry *list_entry;
+    while (!SLIST_EMPTY(&old->list_head)) {
+        list_entry = SLIST_FIRST(&old->list_head);
+        SLIST_REMOVE_HEAD(&old->list_head, pointers);
+        size_t index = list_entry->hash & (hash_table->capacity - 1);
+        SLIST_INSERT_HEAD(&hash_table->entries[index].list_head, list_entry, pointers);
+    }
+    old->migrated = true;
+    return atomic_fetch_add(&hash_table->migrated, 1) + 1 == hash_table->old_capacity;
+}
+
+// Doubles the bucket array. Only the new array is allocated here; the
+// entries are moved a few buckets at a time by later operations.
+static void start_resize(struct hash_table_grow *hash_table, size_t seen_capacity) {
+    lock_all_stripes(hash_table);
+    // Another thread may have already started (or finished) this resize
+    if (hash_table->capacity == seen_capacity && hash_table->old_entries == NULL) {
+        hash_table->old_entries = hash_table->entries;
+        hash_table->old_capacity = hash_table->capacity;
+        hash_table->capacity *= 2;
+        hash_table->entries = alloc_entries(hash_table->capacity);
+        atomic_store(&hash_table->next_migration, 0);
+        atomic_store(&hash_table->migrated, 0);
+        atomic_store(&hash_table->resizing, true);
+    }
+    unlock_all_stripes(hash_table);
+}
+
+static void finish_resize(struct hash_table_grow *hash_table) {
+    lock_all_stripes(hash_table);
+    if (hash_table->old_entries != NULL
+        && atomic_load(&hash_table->migrated) == hash_table->old_capacity) {
+        free(hash_table->old_entries); // every bucket is already empty
+        hash_table->old_entries = NULL;
+        hash_table->old_capacity = 0;
+        atomic_store(&hash_table->resizing, false);
+    }
+    unlock_all_stripes(hash_table);
+}
+
+// Moves up to MIGRATE_PER_OP more old buckets, if a resize is in progress.
+// Called with no stripe lock held.
+static void help_resize(struct hash_table_grow *hash_table) {
+    for (size_t i = 0; i < MIGRATE_PER_OP; ++i) {
+        if (!atomic_load_explicit(&hash_table->resizing, memory_order_relaxed)) {
+            return;
+        }
+        size_t index = atomic_fetch_add(&hash_table->next_migration, 1);
+        struct lock_stripe *stripe = &hash_table->stripes[index % LOCK_STRIPES];
+        lock_stripe(stripe);
+        bool in_range = hash_table->old_entries != NULL && index < hash_table->old_capacity;
+        bool finished = false;
+        if (in_range && !hash_table->old_entries[index].migrated) {
+            finished = migrate_bucket(hash_table, &hash_table->old_entries[index]);
+        }
+        unlock_stripe(stripe);
+        if (finished) {
+            finish_resize(hash_table);
+        }
+        if (!in_range) {
+            return;
+        }
+    }
+}
+
+// Locks the stripe for the key and returns its bucket in the current array,
+// first moving the key's old bucket over if a resize has not reached it yet.
+// Sets *finished if that move completed the resize.
+static struct hash_table_entry *lock_bucket(struct hash_table_grow *hash_table,
+                                            uint32_t hash,
+                                            struct lock_stripe **stripe,
+                                            bool *finished) {
+    *stripe = &hash_table->stripes[hash % LOCK_STRIPES];
+    lock_stripe(*stripe);
+    *finished = false;
+    if (hash_table->old_entries != NULL) {
+        struct hash_table_entry *old = &hash_table->old_entries[hash & (hash_table->old_capacity - 1)];
+        if (!old->migrated) {
+            *finished = migrate_bucket(hash_table, old);
+        }
+    }
+    return &hash_table->entries[hash & (hash_table->capacity - 1)];
+}
+
+static void unlock_bucket(struct hash_table_grow *hash_table,
+                          struct lock_stripe *stripe,
+                          bool finished) {
+    unlock_stripe(stripe);
+    if (finished) {
+        finish_resize(hash_table);
+    }
+    help_resize(hash_table);
+}
+
+static struct list_entry *find_list_entry(struct hash_table_entry *entry, const char *key, uint32_t hash) {
+    struct list_entry *le = NULL;
+    SLIST_FOREACH(le, &entry->list_head, pointers) {
+        if (le->hash == hash && strcmp(le->key, key) == 0) {
+            return le;
+        }
+    }
+    return NULL;
+}
+
+void hash_table_grow_add_entry(struct hash_table_grow *hash_table, const char *key, uint32_t value) {
+    assert(key != NULL);
+    uint32_t hash = hash_table_hash(key);
+    struct lock_stripe *stripe;
+    bool finished;
+    struct hash_table_entry *entry = lock_bucket(hash_table, hash, &stripe, &finished);
+
+    size_t grow_from = 0;
+    struct list_entry *list_entry = find_list_entry(entry, key, hash);
+    if (list_entry == NULL) { // Key not found, create a new list entry
+        list_entry = malloc(sizeof(struct list_entry));
+        char *dup_key = strdup(key);
+        if (list_entry == NULL || dup_key == NULL) {
+            fprintf(stderr, "Failed to allocate memory for new list entry\n");
+            exit(EXIT_FAILURE);
+        }
+        list_entry->key = dup_key;
+        list_entry->hash = hash;
+        list_entry->value = value;
+        SLIST_INSERT_HEAD(&entry->list_head, list_entry, pointers);
+
+        // Each stripe sees 1 / LOCK_STRIPES of the buckets, so its own count
+        // tracks the load factor without a shared counter.
+        ++stripe->count;
+        if (hash_table->old_entries == NULL
+            && stripe->count > MAX_LOAD_FACTOR * (hash_table->capacity / LOCK_STRIPES)) {
+            grow_from = hash_table->capacity;
+        }
+    } else { // Key found, update the value
+        list_entry->value = value;
+    }
+
+    unlock_bucket(hash_table, stripe, finished);
+    if (grow_from != 0) {
+        start_resize(hash_table, grow_from);
+    }
+}
+
+bool hash_table_grow_contains(struct hash_table_grow *hash_table, const char *key) {
+    assert(key != NULL);
+    uint32_t hash = hash_table_hash(key);
+    struct lock_stripe *stripe;
+    bool finished;
+    struct hash_table_entry *entry = lock_bucket(hash_table, hash, &stripe, &finished);
+    bool exists = find_list_entry(entry, key, hash) != NULL;
+    unlock_bucket(hash_table, stripe, finished);
+    return exists;
+}
+
+uint32_t hash_table_grow_get_value(struct hash_table_grow *hash_table, const char *key) {
+    assert(key != NULL);
+    uint32_t hash = hash_table_hash(key);
+    struct lock_stripe *stripe;
+    bool finished;
+    struct hash_table_entry *entry = lock_bucket(hash_table, hash, &stripe, &finished);
+    struct list_entry *list_entry = find_list_entry(entry, key, hash);
+    assert(list_entry != NULL);
+    uint32_t value = list_entry->value;
+    unlock_bucket(hash_table, stripe, finished);
+    return value;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "hash-table-common.h"
+
+#include <stdbool.h>
+
+struct hash_table_grow;
+struct hash_table_grow *hash_table_grow_create();
+void hash_table_grow_add_entry(struct hash_table_grow *hash_table,
+                               const char *key,
+                               uint32_t value);
+bool hash_table_grow_contains(struct hash_table_grow *hash_table,
+                              const char *key);
+uint32_t hash_table_grow_get_value(struct hash_table_grow *hash_table,
+                                   const char* key);
+void hash_table_grow_destroy(struct hash_table_grow *hash_table);
@@ -0,0 +1,106 @@
+#define _GNU_SOURCE // PTHREAD_MUTEX_ADAPTIVE_NP
+#include "hash-table-lock.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <sched.h>
+
+#define SPINS_BEFORE_YIELD 64
+
+static const char *const lock_kind_names[] = {
+    [HASH_TABLE_LOCK_MUTEX] = "mutex",
+    [HASH_TABLE_LOCK_SPIN] = "spin",
+    [HASH_TABLE_LOCK_ADAPTIVE] = "adaptive",
+};
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
+int hash_table_lock_init(struct hash_table_lock *lock, enum hash_table_lock_kind kind) {
+    lock->kind = kind;
+    if (kind == HASH_TABLE_LOCK_SPIN) {
+        atomic_init(&lock->locked, false);
+        return 0;
+    }
+
+    pthread_mutexattr_t attr;
+    int ret = pthread_mutexattr_init(&attr);
+    if (ret != 0) {
+        return ret;
+    }
+#if defined(PTHREAD_ADAPTIVE_MUTEX_INITIALIZER_NP)
+    if (kind == HASH_TABLE_LOCK_ADAPTIVE) {
+        ret = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ADAPTIVE_NP);
+    }
+#endif
+    if (ret == 0) {
+        ret = pthread_mutex_init(&lock->mutex, &attr);
+    }
+    pthread_mutexattr_destroy(&attr);
+    return ret;
+}
+
+int hash_table_lock_acquire(struct hash_table_lock *lock) {
+    if (lock->kind != HASH_TABLE_LOCK_SPIN) {
+        return pthread_mutex_lock(&lock->mutex);
+    }
+    while (atomic_exchange_explicit(&lock->locked, true, memory_order_acquire)) {
+        // Wait with plain loads, so the line stays shared until it is released.
+        // With more threads than cores the holder may not even be running, so
+        // give up the CPU rather than spinning forever.
+        for (unsigned spins = 0; atomic_load_explicit(&lock->locked, memory_order_relaxed); ++spins) {
+            if (spins < SPINS_BEFORE_YIELD) {
+                cpu_relax();
+            } else {
+                sched_yield();
+            }
+        }
+    }
+    return 0;
+}
+
+int hash_table_lock_try(struct hash_table_lock *lock) {
+    if (lock->kind != HASH_TABLE_LOCK_SPIN) {
+        return pthread_mutex_trylock(&lock->mutex);
+    }
+    if (atomic_load_explicit(&lock->locked, memory_order_relaxed)
+        || atomic_exchange_explicit(&lock->locked, true, memory_order_acquire)) {
+        return EBUSY;
+    }
+    return 0;
+}
+
+int hash_table_lock_release(struct hash_table_lock *lock) {
+    if (lock->kind != HASH_TABLE_LOCK_SPIN) {
+        return pthread_mutex_unlock(&lock->mutex);
+    }
+    atomic_store_explicit(&lock->locked, false, memory_order_release);
+    return 0;
+}
+
+void hash_table_lock_destroy(struct hash_table_lock *lock) {
+    if (lock->kind != HASH_TABLE_LOCK_SPIN) {
+        pthread_mutex_destroy(&lock->mutex);
+    }
+}
+
+bool hash_table_lock_kind_parse(const char *name, enum hash_table_lock_kind *kind) {
+    for (size_t i = 0; i < sizeof(lock_kind_names) / sizeof(lock_kind_names[0]); ++i) {
+        if (strcmp(lock_kind_names[i], name) == 0) {
+            *kind = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *hash_table_lock_kind_name(enum hash_table_lock_kind kind) {
+    return lock_kind_names[kind];
+}
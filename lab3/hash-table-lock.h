@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include <pthread.h>
+
+enum hash_table_lock_kind {
+    HASH_TABLE_LOCK_MUTEX,
+    HASH_TABLE_LOCK_SPIN,     // test-and-test-and-set, yields when it spins too long
+    HASH_TABLE_LOCK_ADAPTIVE, // glibc's spin-then-sleep mutex, else a plain mutex
+};
+
+/* A lock on a cache line of its own, so an array of them never has two
+   threads bouncing one line between cores for different locks. */
+struct hash_table_lock {
+    enum hash_table_lock_kind kind;
+    union {
+        pthread_mutex_t mutex;
+        atomic_bool locked;
+    };
+} __attribute__((aligned(64)));
+
+/* Each returns 0 or an error number, like the pthread_mutex calls */
+int hash_table_lock_init(struct hash_table_lock *lock,
+                         enum hash_table_lock_kind kind);
+int hash_table_lock_acquire(struct hash_table_lock *lock);
+/* Returns EBUSY instead of waiting if the lock is held */
+int hash_table_lock_try(struct hash_table_lock *lock);
+int hash_table_lock_release(struct hash_table_lock *lock);
+void hash_table_lock_destroy(struct hash_table_lock *lock);
+
+/* Kinds are named mutex, spin and adaptive */
+bool hash_table_lock_kind_parse(const char *name,
+                                enum hash_table_lock_kind *kind);
+const char *hash_table_lock_kind_name(enum hash_table_lock_kind kind);
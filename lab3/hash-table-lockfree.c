@@ -0,0 +1,280 @@
+#include "hash-table-lockfree.h"
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A split-ordered list (Shalev and Shavit): every entry lives in one
+// sorted linked list, ordered by its bit-reversed hash. Buckets are just
+// shortcuts into that list through "dummy" nodes, so doubling the bucket
+// count never moves an entry. A new bucket is initialized lazily by
+// splicing its dummy node in after the dummy of its parent bucket.
+// Nothing is ever removed, so insertion needs only a CAS on one next
+// pointer and no memory reclamation.
+
+#define MAX_LOAD_FACTOR 2
+#define COUNT_SHARDS 64 // entry counters, spread out to avoid one hot counter
+#define CACHE_LINE_SIZE 64
+
+// Segment 0 holds the first HASH_TABLE_CAPACITY buckets and segment s
+// holds HASH_TABLE_CAPACITY << (s - 1) more, so the directory doubles
+// without ever copying. Bucket indices come from 32-bit hashes.
+#define FIRST_SEGMENT_BITS __builtin_ctz(HASH_TABLE_CAPACITY)
+#define MAX_SEGMENTS (32 - FIRST_SEGMENT_BITS + 1)
+#define MAX_BUCKETS (1ull << 32)
+
+struct list_entry {
+    uint64_t so_key;  // split-order key: odd for entries, even for dummies
+    const char *key;  // NULL for dummy nodes
+    _Atomic uint32_t value;
+    _Atomic(struct list_entry *) next;
+};
+
+struct count_shard {
+    atomic_size_t count;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct hash_table_lockfree {
+    _Atomic(_Atomic(struct list_entry *) *) segments[MAX_SEGMENTS];
+    atomic_size_t bucket_count;
+    struct count_shard shards[COUNT_SHARDS];
+};
+
+_Static_assert((HASH_TABLE_CAPACITY & (HASH_TABLE_CAPACITY - 1)) == 0,
+               "HASH_TABLE_CAPACITY must be a power of two");
+
+static uint32_t reverse_bits(uint32_t x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+    return __builtin_bswap32(x);
+}
+
+static uint64_t so_regular_key(uint32_t hash) {
+    return ((uint64_t)reverse_bits(hash) << 1) | 1;
+}
+
+static uint64_t so_dummy_key(uint32_t bucket) {
+    return (uint64_t)reverse_bits(bucket) << 1;
+}
+
+// Bucket indices are the low bits of the hash, which the default bernstein_hash
+// barely mixes, so finish it with the murmur3 finalizer.
+static uint32_t mix_hash(uint32_t hash) {
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+static struct list_entry *alloc_list_entry(uint64_t so_key, const char *key, uint32_t value) {
+    struct list_entry *list_entry = malloc(sizeof(struct list_entry));
+    if (list_entry == NULL) {
+        fprintf(stderr, "Failed to allocate memory for new list entry\n");
+        exit(EXIT_FAILURE);
+    }
+    list_entry->so_key = so_key;
+    list_entry->key = key;
+    atomic_init(&list_entry->value, value);
+    atomic_init(&list_entry->next, NULL);
+    return list_entry;
+}
+
+static size_t segment_index(size_t bucket) {
+    if (bucket < HASH_TABLE_CAPACITY) {
+        return 0;
+    }
+    return 64 - __builtin_clzll(bucket) - FIRST_SEGMENT_BITS;
+}
+
+static size_t segment_size(size_t segment) {
+    return segment == 0 ? HASH_TABLE_CAPACITY : (size_t)HASH_TABLE_CAPACITY << (segment - 1);
+}
+
+// Returns the directory slot for a bucket, allocating its segment if no
+// thread has yet. Racing allocators CAS the segment in and the loser frees.
+static _Atomic(struct list_entry *) *get_bucket_slot(struct hash_table_lockfree *hash_table, size_t bucket) {
+    size_t segment = segment_index(bucket);
+    size_t offset = segment == 0 ? bucket : bucket - segment_size(segment);
+    _Atomic(struct list_entry *) *slots = atomic_load_explicit(&hash_table->segments[segment], memory_order_acquire);
+    if (slots == NULL) {
+        _Atomic(struct list_entry *) *fresh = calloc(segment_size(segment), sizeof(*fresh));
+        if (fresh == NULL) {
+            fprintf(stderr, "Failed to allocate memory for bucket segment\n");
+            exit(EXIT_FAILURE);
+        }
+        if (atomic_compare_exchange_strong_explicit(&hash_table->segments[segment], &slots, fresh,
+                                                    memory_order_acq_rel, memory_order_acquire)) {
+            slots = fresh;
+        } else {
+            free(fresh);
+        }
+    }
+    return &slots[offset];
+}
+
+// Finds the dummy node with the given split-order key after start, or
+// splices a new one in. Returns the dummy that ends up in the list.
+static struct list_entry *insert_dummy(struct list_entry *start, uint64_t so_key) {
+    struct list_entry *dummy = NULL;
+    struct list_entry *prev = start;
+    struct list_entry *curr = atomic_load_explicit(&prev->next, memory_order_acquire);
+    while (true) {
+        while (curr != NULL && curr->so_key < so_key) {
+            prev = curr;
+            curr = atomic_load_explicit(&prev->next, memory_order_acquire);
+        }
+        if (curr != NULL && curr->so_key == so_key) {
+            free(dummy); // another thread initialized this bucket first
+            return curr;
+        }
+        if (dummy == NULL) {
+            dummy = alloc_list_entry(so_key, NULL, 0);
+        }
+        atomic_store_explicit(&dummy->next, curr, memory_order_relaxed);
+        // On failure curr is reloaded and the search resumes from prev,
+        // which stays valid because nodes are never removed.
+        if (atomic_compare_exchange_weak_explicit(&prev->next, &curr, dummy,
+                                                  memory_order_release, memory_order_acquire)) {
+            return dummy;
+        }
+    }
+}
+
+static struct list_entry *get_bucket(struct hash_table_lockfree *hash_table, size_t bucket) {
+    _Atomic(struct list_entry *) *slot = get_bucket_slot(hash_table, bucket);
+    struct list_entry *dummy = atomic_load_explicit(slot, memory_order_acquire);
+    if (dummy != NULL) {
+        return dummy;
+    }
+    // The parent bucket is this one with its highest bit cleared; its
+    // dummy precedes ours in split order.
+    size_t parent = bucket & ~((size_t)1 << (63 - __builtin_clzll(bucket)));
+    dummy = insert_dummy(get_bucket(hash_table, parent), so_dummy_key(bucket));
+    atomic_store_explicit(slot, dummy, memory_order_release);
+    return dummy;
+}
+
+struct hash_table_lockfree *hash_table_lockfree_create() {
+    struct hash_table_lockfree *hash_table = aligned_alloc(CACHE_LINE_SIZE, sizeof(struct hash_table_lockfree));
+    if (hash_table == NULL) {
+        fprintf(stderr, "Failed to allocate memory for hash table\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < MAX_SEGMENTS; ++i) {
+        atomic_init(&hash_table->segments[i], NULL);
+    }
+    for (size_t i = 0; i < COUNT_SHARDS; ++i) {
+        atomic_init(&hash_table->shards[i].count, 0);
+    }
+    atomic_init(&hash_table->bucket_count, HASH_TABLE_CAPACITY);
+    // Bucket 0's dummy is the head of the whole list
+    atomic_store(get_bucket_slot(hash_table, 0), alloc_list_entry(so_dummy_key(0), NULL, 0));
+    return hash_table;
+}
+
+void hash_table_lockfree_destroy(struct hash_table_lockfree *hash_table) {
+    struct list_entry *list_entry = atomic_load(get_bucket_slot(hash_table, 0));
+    while (list_entry != NULL) {
+        struct list_entry *next = atomic_load_explicit(&list_entry->next, memory_order_relaxed);
+        free((void*)list_entry->key);
+        free(list_entry);
+        list_entry = next;
+    }
+    for (size_t i = 0; i < MAX_SEGMENTS; ++i) {
+        free(atomic_load(&hash_table->segments[i]));
+    }
+    free(hash_table);
+}
+
+// Walks from the key's bucket to the first node that is not ordered
+// before it, then through any entries sharing its split-order key.
+static struct list_entry *find_list_entry(struct list_entry *prev, uint64_t so_key, const char *key,
+                                          struct list_entry **last) {
+    struct list_entry *curr = atomic_load_explicit(&prev->next, memory_order_acquire);
+    while (curr != NULL && curr->so_key <= so_key) {
+        if (curr->so_key == so_key && strcmp(curr->key, key) == 0) {
+            return curr;
+        }
+        prev = curr;
+        curr = atomic_load_explicit(&prev->next, memory_order_acquire);
+    }
+    if (last != NULL) {
+        *last = prev;
+    }
+    return NULL;
+}
+
+static void count_insert(struct hash_table_lockfree *hash_table, uint32_t hash) {
+    struct count_shard *shard = &hash_table->shards[hash % COUNT_SHARDS];
+    size_t count = atomic_fetch_add_explicit(&shard->count, 1, memory_order_relaxed) + 1;
+    size_t buckets = atomic_load_explicit(&hash_table->bucket_count, memory_order_relaxed);
+    // Each shard sees about 1 / COUNT_SHARDS of the entries
+    if (count * COUNT_SHARDS > buckets * MAX_LOAD_FACTOR && buckets * 2 <= MAX_BUCKETS) {
+        atomic_compare_exchange_strong(&hash_table->bucket_count, &buckets, buckets * 2);
+    }
+}
+
+void hash_table_lockfree_add_entry(struct hash_table_lockfree *hash_table, const char *key, uint32_t value) {
+    assert(key != NULL);
+    uint32_t hash = mix_hash(hash_table_hash(key));
+    uint64_t so_key = so_regular_key(hash);
+    size_t buckets = atomic_load_explicit(&hash_table->bucket_count, memory_order_relaxed);
+    struct list_entry *prev = get_bucket(hash_table, hash & (buckets - 1));
+
+    struct list_entry *list_entry = NULL;
+    while (true) {
+        struct list_entry *found = find_list_entry(prev, so_key, key, &prev);
+        if (found != NULL) { // Key found, update the value
+            atomic_store_explicit(&found->value, value, memory_order_relaxed);
+            if (list_entry != NULL) {
+                free((void*)list_entry->key);
+                free(list_entry);
+            }
+            return;
+        }
+        if (list_entry == NULL) {
+            char *dup_key = strdup(key);
+            if (dup_key == NULL) {
+                fprintf(stderr, "Failed to duplicate key\n");
+                exit(EXIT_FAILURE);
+            }
+            list_entry = alloc_list_entry(so_key, dup_key, value);
+        }
+        // New keys always go after every entry with the same split-order
+        // key, so a racing insert of the same key fails this CAS and the
+        // retry from prev sees it.
+        struct list_entry *curr = atomic_load_explicit(&prev->next, memory_order_acquire);
+        if (curr != NULL && curr->so_key <= so_key) {
+            continue;
+        }
+        atomic_store_explicit(&list_entry->next, curr, memory_order_relaxed);
+        if (atomic_compare_exchange_strong_explicit(&prev->next, &curr, list_entry,
+                                                    memory_order_release, memory_order_relaxed)) {
+            break;
+        }
+    }
+    count_insert(hash_table, hash);
+}
+
+static struct list_entry *lookup(struct hash_table_lockfree *hash_table, const char *key) {
+    assert(key != NULL);
+    uint32_t hash = mix_hash(hash_table_hash(key));
+    size_t buckets = atomic_load_explicit(&hash_table->bucket_count, memory_order_relaxed);
+    struct list_entry *dummy = get_bucket(hash_table, hash & (buckets - 1));
+    return find_list_entry(dummy, so_regular_key(hash), key, NULL);
+}
+
+bool hash_table_lockfree_contains(struct hash_table_lockfree *hash_table, const char *key) {
+    return lookup(hash_table, key) != NULL;
+}
+
+uint32_t hash_table_lockfree_get_value(struct hash_table_lockfree *hash_table, const char *key) {
+    struct list_entry *list_entry = lookup(hash_table, key);
+    assert(list_entry != NULL);
+    return atomic_load_explicit(&list_entry->value, memory_order_relaxed);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "hash-table-common.h"
+
+#include <stdbool.h>
+
+struct hash_table_lockfree;
+struct hash_table_lockfree *hash_table_lockfree_create();
+void hash_table_lockfree_add_entry(struct hash_table_lockfree *hash_table,
+                                   const char *key,
+                                   uint32_t value);
+bool hash_table_lockfree_contains(struct hash_table_lockfree *hash_table,
+                                  const char *key);
+uint32_t hash_table_lockfree_get_value(struct hash_table_lockfree *hash_table,
+                                       const char* key);
+void hash_table_lockfree_destroy(struct hash_table_lockfree *hash_table);
@@ -0,0 +1,325 @@
+#include "hash-table-mmap.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// File layout, all integers in native byte order:
+//
+//   struct mmap_header
+//   uint64_t buckets[bucket_count + 1]        bucket b is entries[buckets[b]] up to entries[buckets[b + 1]]
+//   struct mmap_entry entries[entry_count]    grouped by bucket
+//   key bytes                                 each key followed by a NUL
+//
+// The buckets are sized for the file rather than copied from the table,
+// so there are about as many buckets as entries and chains stay short.
+
+#define MMAP_MAGIC "lab3htbl"
+#define MMAP_VERSION 1
+#define MMAP_HASH_FUNCTION "wyhash"
+
+struct mmap_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t bucket_bits;  // bucket_count is 1 << bucket_bits
+    uint64_t entry_count;
+    uint64_t file_size;
+    uint64_t buckets_offset;
+    uint64_t entries_offset;
+    uint64_t keys_offset;
+    char hash_function[16]; // name of the function in hash_functions used
+};
+
+struct mmap_entry {
+    uint32_t hash;
+    uint32_t value;
+    uint64_t key_offset; // from the start of the file
+    uint64_t key_length; // without the NUL
+};
+
+struct hash_table_mmap {
+    const char *base;
+    size_t size;
+    const struct mmap_header *header;
+    const uint64_t *buckets;
+    const struct mmap_entry *entries;
+    uint64_t bucket_mask;
+    uint32_t (*hash)(const char *string);
+};
+
+// Spreads the hash over the low bits used to pick a bucket (murmur3 fmix32)
+static uint32_t mix_hash(uint32_t hash) {
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+static uint64_t align8(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+// Whether [offset, offset + count * size) lies within a file of file_size bytes
+static bool in_file(uint64_t offset, uint64_t count, uint64_t size, uint64_t file_size) {
+    return offset <= file_size && (file_size - offset) / size >= count;
+}
+
+struct hash_table_mmap *hash_table_open_mmap(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "Failed to stat %s: %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    if ((size_t)st.st_size < sizeof(struct mmap_header)) {
+        fprintf(stderr, "%s is too small to be a hash table\n", path);
+        close(fd);
+        return NULL;
+    }
+    const char *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    madvise((void *)base, st.st_size, MADV_RANDOM);
+
+    // Only the header and the array bounds are checked up front; each
+    // lookup checks just the bucket and key it touches
+    const struct mmap_header *header = (const struct mmap_header *)base;
+    const struct hash_function *function = NULL;
+    if (memcmp(header->magic, MMAP_MAGIC, sizeof(header->magic)) == 0
+        && memchr(header->hash_function, 0, sizeof(header->hash_function)) != NULL) {
+        function = hash_function_find(header->hash_function);
+    }
+    uint64_t size = st.st_size;
+    if (function == NULL || header->version != MMAP_VERSION || header->file_size != size
+        || header->bucket_bits >= 32 || header->buckets_offset % 8 != 0 || header->entries_offset % 8 != 0
+        || !in_file(header->buckets_offset, (1ull << header->bucket_bits) + 1, sizeof(uint64_t), size)
+        || !in_file(header->entries_offset, header->entry_count, sizeof(struct mmap_entry), size)) {
+        fprintf(stderr, "%s is not a valid hash table file\n", path);
+        munmap((void *)base, st.st_size);
+        return NULL;
+    }
+
+    struct hash_table_mmap *hash_table = malloc(sizeof(struct hash_table_mmap));
+    if (hash_table == NULL) {
+        fprintf(stderr, "Failed to allocate memory for hash table\n");
+        exit(EXIT_FAILURE);
+    }
+    hash_table->base = base;
+    hash_table->size = st.st_size;
+    hash_table->header = header;
+    hash_table->buckets = (const uint64_t *)(base + header->buckets_offset);
+    hash_table->entries = (const struct mmap_entry *)(base + header->entries_offset);
+    hash_table->bucket_mask = (1ull << header->bucket_bits) - 1;
+    hash_table->hash = function->hash;
+    return hash_table;
+}
+
+static const struct mmap_entry *find_entry(struct hash_table_mmap *hash_table, const char *key) {
+    assert(key != NULL);
+    uint32_t hash = hash_table->hash(key);
+    size_t length = strlen(key);
+    uint64_t bucket = mix_hash(hash) & hash_table->bucket_mask;
+    uint64_t first = hash_table->buckets[bucket];
+    uint64_t last = hash_table->buckets[bucket + 1];
+    if (first > last || last > hash_table->header->entry_count) {
+        return NULL; // a damaged file
+    }
+    for (uint64_t i = first; i < last; ++i) {
+        const struct mmap_entry *entry = &hash_table->entries[i];
+        if (entry->hash == hash && entry->key_length == length
+            && in_file(entry->key_offset, length + 1, 1, hash_table->size)
+            && memcmp(hash_table->base + entry->key_offset, key, length) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+bool hash_table_mmap_contains(struct hash_table_mmap *hash_table, const char *key) {
+    return find_entry(hash_table, key) != NULL;
+}
+
+uint32_t hash_table_mmap_get_value(struct hash_table_mmap *hash_table, const char *key) {
+    const struct mmap_entry *entry = find_entry(hash_table, key);
+    assert(entry != NULL);
+    return entry->value;
+}
+
+size_t hash_table_mmap_size(struct hash_table_mmap *hash_table) {
+    return hash_table->header->entry_count;
+}
+
+void hash_table_mmap_close(struct hash_table_mmap *hash_table) {
+    munmap((void *)hash_table->base, hash_table->size);
+    free(hash_table);
+}
+
+// Entries collected from the table before they are laid out
+struct dump {
+    uint32_t (*hash)(const char *string);
+    struct mmap_entry *entries; // key_offset is into keys until written
+    size_t entry_count;
+    size_t entry_capacity;
+    char *keys;
+    size_t keys_size;
+    size_t keys_capacity;
+};
+
+static void *grow_array(void *array, size_t *capacity, size_t needed, size_t size) {
+    if (needed <= *capacity) {
+        return array;
+    }
+    size_t new_capacity = *capacity == 0 ? 1024 : *capacity;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    array = realloc(array, new_capacity * size);
+    if (array == NULL) {
+        fprintf(stderr, "Failed to allocate memory for hash table dump\n");
+        exit(EXIT_FAILURE);
+    }
+    *capacity = new_capacity;
+    return array;
+}
+
+static void collect_entry(void *context, const char *key, uint32_t value) {
+    struct dump *dump = context;
+    size_t length = strlen(key);
+    dump->entries = grow_array(dump->entries, &dump->entry_capacity, dump->entry_count + 1,
+                               sizeof(struct mmap_entry));
+    dump->keys = grow_array(dump->keys, &dump->keys_capacity, dump->keys_size + length + 1, 1);
+    dump->entries[dump->entry_count++] = (struct mmap_entry){
+        .hash = dump->hash(key),
+        .value = value,
+        .key_offset = dump->keys_size,
+        .key_length = length,
+    };
+    memcpy(dump->keys + dump->keys_size, key, length + 1);
+    dump->keys_size += length + 1;
+}
+
+static int write_all(FILE *file, const void *data, size_t size) {
+    if (size > 0 && fwrite(data, size, 1, file) != 1) {
+        return errno != 0 ? errno : EIO;
+    }
+    return 0;
+}
+
+int hash_table_mmap_write_v2(struct hash_table_v2 *hash_table, const char *path) {
+    struct dump dump = { .hash = hash_function_find(MMAP_HASH_FUNCTION)->hash };
+    hash_table_v2_for_each(hash_table, collect_entry, &dump);
+
+    uint32_t bucket_bits = 0;
+    while ((1ull << bucket_bits) < dump.entry_count) {
+        ++bucket_bits;
+    }
+    uint64_t bucket_count = 1ull << bucket_bits;
+
+    // Counting sort of the entries by bucket
+    uint64_t *buckets = calloc(bucket_count + 1, sizeof(uint64_t));
+    struct mmap_entry *sorted = malloc((dump.entry_count > 0 ? dump.entry_count : 1) * sizeof(struct mmap_entry));
+    if (buckets == NULL || sorted == NULL) {
+        fprintf(stderr, "Failed to allocate memory for hash table dump\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < dump.entry_count; ++i) {
+        ++buckets[(mix_hash(dump.entries[i].hash) & (bucket_count - 1)) + 1];
+    }
+    for (uint64_t b = 0; b < bucket_count; ++b) {
+        buckets[b + 1] += buckets[b];
+    }
+
+    struct mmap_header header = {
+        .magic = MMAP_MAGIC,
+        .version = MMAP_VERSION,
+        .bucket_bits = bucket_bits,
+        .entry_count = dump.entry_count,
+        .buckets_offset = align8(sizeof(struct mmap_header)),
+        .hash_function = MMAP_HASH_FUNCTION,
+    };
+    header.entries_offset = header.buckets_offset + (bucket_count + 1) * sizeof(uint64_t);
+    header.keys_offset = header.entries_offset + dump.entry_count * sizeof(struct mmap_entry);
+    header.file_size = header.keys_offset + dump.keys_size;
+
+    uint64_t *cursor = malloc(bucket_count * sizeof(uint64_t));
+    if (cursor == NULL) {
+        fprintf(stderr, "Failed to allocate memory for hash table dump\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(cursor, buckets, bucket_count * sizeof(uint64_t));
+    for (size_t i = 0; i < dump.entry_count; ++i) {
+        struct mmap_entry entry = dump.entries[i];
+        entry.key_offset += header.keys_offset;
+        sorted[cursor[mix_hash(entry.hash) & (bucket_count - 1)]++] = entry;
+    }
+    free(cursor);
+
+    // Write next to the destination and rename over it, so a reader never
+    // maps a half written file
+    size_t path_length = strlen(path);
+    char *temp_path = malloc(path_length + sizeof(".tmp"));
+    if (temp_path == NULL) {
+        fprintf(stderr, "Failed to allocate memory for hash table dump\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(temp_path, path, path_length);
+    memcpy(temp_path + path_length, ".tmp", sizeof(".tmp"));
+
+    int ret = 0;
+    FILE *file = fopen(temp_path, "wb");
+    if (file == NULL) {
+        ret = errno;
+    } else {
+        static const char padding[8];
+        errno = 0;
+        ret = write_all(file, &header, sizeof(header));
+        if (ret == 0) {
+            ret = write_all(file, padding, header.buckets_offset - sizeof(header));
+        }
+        if (ret == 0) {
+            ret = write_all(file, buckets, (bucket_count + 1) * sizeof(uint64_t));
+        }
+        if (ret == 0) {
+            ret = write_all(file, sorted, dump.entry_count * sizeof(struct mmap_entry));
+        }
+        if (ret == 0) {
+            ret = write_all(file, dump.keys, dump.keys_size);
+        }
+        if (ret == 0 && (fflush(file) != 0 || fsync(fileno(file)) != 0)) {
+            ret = errno;
+        }
+        if (fclose(file) != 0 && ret == 0) {
+            ret = errno;
+        }
+        if (ret == 0 && rename(temp_path, path) != 0) {
+            ret = errno;
+        }
+        if (ret != 0) {
+            unlink(temp_path);
+        }
+    }
+
+    free(temp_path);
+    free(sorted);
+    free(buckets);
+    free(dump.keys);
+    free(dump.entries);
+    return ret;
+}
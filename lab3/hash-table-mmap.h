@@ -0,0 +1,27 @@
+#pragma once
+
+#include "hash-table-common.h"
+#include "hash-table-v2.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A read-only table served straight out of a file mapped with mmap. The
+   file refers to everything by its offset from the start of the file, so
+   it needs no fixing up and works mapped at any address. Lookups from any
+   number of threads need no locks. */
+struct hash_table_mmap;
+/* Returns NULL, after saying why on stderr, if the file is missing or
+   is not a table */
+struct hash_table_mmap *hash_table_open_mmap(const char *path);
+bool hash_table_mmap_contains(struct hash_table_mmap *hash_table,
+                              const char *key);
+uint32_t hash_table_mmap_get_value(struct hash_table_mmap *hash_table,
+                                   const char* key);
+size_t hash_table_mmap_size(struct hash_table_mmap *hash_table);
+void hash_table_mmap_close(struct hash_table_mmap *hash_table);
+
+/* Writes every entry of a v2 table to path, replacing it atomically.
+   Returns 0, or an errno value if the file could not be written. */
+int hash_table_mmap_write_v2(struct hash_table_v2 *hash_table,
+                             const char *path);
@@ -0,0 +1,92 @@
+#include "hash-table-stats.h"
+#include "hash-table-common.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define COUNTER_SHARDS 64 // threads beyond this share a shard
+#define CACHE_LINE_SIZE 64
+
+struct counter_shard {
+    atomic_uint_least64_t acquisitions;
+    atomic_uint_least64_t contended;
+    atomic_uint_least64_t wait_ns;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+// Each thread only ever adds to its own shard, so the counters stay in
+// that thread's cache and counting adds no sharing between threads
+struct hash_table_lock_counters {
+    struct counter_shard shards[COUNTER_SHARDS];
+};
+
+static atomic_bool stats_enabled;
+
+void hash_table_stats_enable(bool enabled) {
+    atomic_store(&stats_enabled, enabled);
+}
+
+struct hash_table_lock_counters *hash_table_lock_counters_create() {
+    struct hash_table_lock_counters *counters = aligned_alloc(CACHE_LINE_SIZE, sizeof(struct hash_table_lock_counters));
+    if (counters == NULL) {
+        fprintf(stderr, "Failed to allocate memory for lock counters\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < COUNTER_SHARDS; ++i) {
+        atomic_init(&counters->shards[i].acquisitions, 0);
+        atomic_init(&counters->shards[i].contended, 0);
+        atomic_init(&counters->shards[i].wait_ns, 0);
+    }
+    return counters;
+}
+
+void hash_table_lock_counters_destroy(struct hash_table_lock_counters *counters) {
+    free(counters);
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int hash_table_lock_acquire_counted(struct hash_table_lock *lock, struct hash_table_lock_counters *counters) {
+    if (!atomic_load_explicit(&stats_enabled, memory_order_relaxed)) {
+        return hash_table_lock_acquire(lock);
+    }
+
+    struct counter_shard *shard = &counters->shards[hash_table_thread_index() % COUNTER_SHARDS];
+    atomic_fetch_add_explicit(&shard->acquisitions, 1, memory_order_relaxed);
+    int ret = hash_table_lock_try(lock);
+    if (ret != EBUSY) {
+        return ret;
+    }
+
+    // Only contended acquisitions pay for reading the clock
+    uint64_t start = now_ns();
+    ret = hash_table_lock_acquire(lock);
+    atomic_fetch_add_explicit(&shard->contended, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&shard->wait_ns, now_ns() - start, memory_order_relaxed);
+    return ret;
+}
+
+void hash_table_lock_counters_collect(struct hash_table_lock_counters *counters, struct hash_table_stats *stats) {
+    for (size_t i = 0; i < COUNTER_SHARDS; ++i) {
+        stats->acquisitions += atomic_load_explicit(&counters->shards[i].acquisitions, memory_order_relaxed);
+        stats->contended += atomic_load_explicit(&counters->shards[i].contended, memory_order_relaxed);
+        stats->wait_ns += atomic_load_explicit(&counters->shards[i].wait_ns, memory_order_relaxed);
+    }
+}
+
+void hash_table_stats_add_chain(struct hash_table_stats *stats, size_t length) {
+    if (length > stats->longest_chain) {
+        stats->longest_chain = length;
+    }
+    size_t bucket = length == 0 ? 0 : 64 - __builtin_clzll(length);
+    if (bucket >= HASH_TABLE_STATS_CHAIN_LENGTHS) {
+        bucket = HASH_TABLE_STATS_CHAIN_LENGTHS - 1;
+    }
+    ++stats->chain_lengths[bucket];
+}
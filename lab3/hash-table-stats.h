@@ -0,0 +1,38 @@
+#pragma once
+
+#include "hash-table-lock.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Chain lengths are counted in powers of two: bucket 0 counts empty
+   chains and bucket i > 0 counts lengths from 2^(i-1) to 2^i - 1 */
+#define HASH_TABLE_STATS_CHAIN_LENGTHS 16
+
+struct hash_table_stats {
+    uint64_t acquisitions;
+    uint64_t contended; // acquisitions where the lock was already held
+    uint64_t wait_ns;   // time spent waiting in contended acquisitions
+    size_t longest_chain;
+    size_t chain_lengths[HASH_TABLE_STATS_CHAIN_LENGTHS];
+};
+
+/* Lock counting is off until enabled, and costs one load per acquisition
+   while off. Only switch it while no table is in use. */
+void hash_table_stats_enable(bool enabled);
+
+/* Per-thread lock counters for one table */
+struct hash_table_lock_counters;
+struct hash_table_lock_counters *hash_table_lock_counters_create();
+void hash_table_lock_counters_destroy(struct hash_table_lock_counters *counters);
+
+/* hash_table_lock_acquire, but first tries the lock so contended
+   acquisitions and their wait time can be counted */
+int hash_table_lock_acquire_counted(struct hash_table_lock *lock,
+                                    struct hash_table_lock_counters *counters);
+
+/* Adds the counters of every thread into stats */
+void hash_table_lock_counters_collect(struct hash_table_lock_counters *counters,
+                                      struct hash_table_stats *stats);
+void hash_table_stats_add_chain(struct hash_table_stats *stats, size_t length);
@@ -1,28 +1,247 @@
+#include "hash-table-affinity.h"
 #include "hash-table-base.h"
 #include "hash-table-v1.h"
 #include "hash-table-v2.h"
+#include "hash-table-v3.h"
+#include "hash-table-grow.h"
+#include "hash-table-lockfree.h"
+#include "hash-table-cuckoo.h"
+#include "hash-table-mmap.h"
+#include "hash-table-typed.h"
+#include "hash-table-workload.h"
 
 #include <argp.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <locale.h>
+#include <math.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <unistd.h>
 
 char *entries;
 
 void (*add_entry)(void *, const char *key, uint32_t value);
 
 #define BYTES_PER_STRING 8
+#define KEY_SEED 42
+
+/* Compile-time specialized tables: typed-u64 packs a key into a uint64_t,
+   which holds the whole of a key up to BYTES_PER_STRING - 1 bytes long, and
+   typed-str keeps v2's string keys but calls bernstein_hash and strcmp
+   directly. Each is built with TYPED_CAPACITY buckets, which at the default
+   sizes keeps chains a few entries long where v2's are dozens, and again
+   with v2's HASH_TABLE_CAPACITY, so that specialization can be compared on
+   its own. */
+#define TYPED_CAPACITY (1u << 18)
+
+HASH_TABLE_TYPED_DEFINE(typed_u64, uint64_t, uint32_t, TYPED_CAPACITY,
+                        hash_table_typed_hash_u64, HASH_TABLE_TYPED_EQUAL)
+HASH_TABLE_TYPED_DEFINE(typed_str, const char *, uint32_t, TYPED_CAPACITY,
+                        bernstein_hash, HASH_TABLE_TYPED_STRING_EQUAL)
+HASH_TABLE_TYPED_DEFINE(typed_u64_narrow, uint64_t, uint32_t, HASH_TABLE_CAPACITY,
+                        hash_table_typed_hash_u64, HASH_TABLE_TYPED_EQUAL)
+HASH_TABLE_TYPED_DEFINE(typed_str_narrow, const char *, uint32_t, HASH_TABLE_CAPACITY,
+                        bernstein_hash, HASH_TABLE_TYPED_STRING_EQUAL)
+
+static inline uint64_t key_word(const char *key)
+{
+	uint64_t word = 0;
+	memcpy(&word, key, strnlen(key, sizeof(word)));
+	return word;
+}
+
+static void typed_u64_add_string(void *hash_table, const char *key, uint32_t value)
+{
+	typed_u64_add_entry(hash_table, key_word(key), value);
+}
+
+static bool typed_u64_contains_string(void *hash_table, const char *key)
+{
+	return typed_u64_contains(hash_table, key_word(key));
+}
+
+static void typed_u64_narrow_add_string(void *hash_table, const char *key, uint32_t value)
+{
+	typed_u64_narrow_add_entry(hash_table, key_word(key), value);
+}
+
+static bool typed_u64_narrow_contains_string(void *hash_table, const char *key)
+{
+	return typed_u64_narrow_contains(hash_table, key_word(key));
+}
+
+static void *create_v2_combining(void)
+{
+	struct hash_table_v2_config config = {
+		.lock_stripes = HASH_TABLE_CAPACITY,
+		.lock = HASH_TABLE_LOCK_MUTEX,
+		.flat_combining = true,
+	};
+	return hash_table_v2_create_with(&config);
+}
+
+/* Tables that can be run by name with --table, --scaling or --workload */
+static const struct hash_table_impl hash_table_impls[] = {
+	{ "base", true,
+	  (void *(*)(void)) hash_table_base_create,
+	  (void (*)(void *, const char *, uint32_t)) hash_table_base_add_entry,
+	  (bool (*)(void *, const char *)) hash_table_base_contains,
+	  (void (*)(void *)) hash_table_base_destroy },
+	{ "v1", false,
+	  (void *(*)(void)) hash_table_v1_create,
+	  (void (*)(void *, const char *, uint32_t)) hash_table_v1_add_entry,
+	  (bool (*)(void *, const char *)) hash_table_v1_contains,
+	  (void (*)(void *)) hash_table_v1_destroy,
+	  (void (*)(void *, struct hash_table_stats *)) hash_table_v1_get_stats },
+	{ "v2", false,
+	  (void *(*)(void)) hash_table_v2_create,
+	  (void (*)(void *, const char *, uint32_t)) hash_table_v2_add_entry,
+	  (bool (*)(void *, const char *)) hash_table_v2_contains,
+	  (void (*)(void *)) hash_table_v2_destroy,
+	  (void (*)(void *, struct hash_table_stats *)) hash_table_v2_get_stats,
+	  (bool (*)(void *, const char *)) hash_table_v2_remove },
+	{ "v2-combining", false,
+	  create_v2_combining,
+	  (void (*)(void *, const char *, uint32_t)) hash_table_v2_add_entry,
+	  (bool (*)(void *, const char *)) hash_table_v2_contains,
+	  (void (*)(void *)) hash_table_v2_destroy,
+	  (void (*)(void *, struct hash_table_stats *)) hash_table_v2_get_stats,
+	  (bool (*)(void *, const char *)) hash_table_v2_remove },
+	{ "typed-u64", false,
+	  (void *(*)(void)) typed_u64_create,
+	  typed_u64_add_string,
+	  typed_u64_contains_string,
+	  (void (*)(void *)) typed_u64_destroy },
+	{ "typed-str", false,
+	  (void *(*)(void)) typed_str_create,
+	  (void (*)(void *, const char *, uint32_t)) typed_str_add_entry,
+	  (bool (*)(void *, const char *)) typed_str_contains,
+	  (void (*)(void *)) typed_str_destroy },
+	{ "typed-u64/4096", false,
+	  (void *(*)(void)) typed_u64_narrow_create,
+	  typed_u64_narrow_add_string,
+	  typed_u64_narrow_contains_string,
+	  (void (*)(void *)) typed_u64_narrow_destroy },
+	{ "typed-str/4096", false,
+	  (void *(*)(void)) typed_str_narrow_create,
+	  (void (*)(void *, const char *, uint32_t)) typed_str_narrow_add_entry,
+	  (bool (*)(void *, const char *)) typed_str_narrow_contains,
+	  (void (*)(void *)) typed_str_narrow_destroy },
+	{ "v3", true,
+	  (void *(*)(void)) hash_table_v3_create,
+	  (void (*)(void *, const char *, uint32_t)) hash_table_v3_add_entry,
+	  (bool (*)(void *, const char *)) hash_table_v3_contains,
+	  (void (*)(void *)) hash_table_v3_destroy },
+	{ "grow", false,
+	  (void *(*)(void)) hash_table_grow_create,
+	  (void (*)(void *, const char *, uint32_t)) hash_table_grow_add_entry,
+	  (bool (*)(void *, const char *)) hash_table_grow_contains,
+	  (void (*)(void *)) hash_table_grow_destroy },
+	{ "lockfree", false,
+	  (void *(*)(void)) hash_table_lockfree_create,
+	  (void (*)(void *, const char *, uint32_t)) hash_table_lockfree_add_entry,
+	  (bool (*)(void *, const char *)) hash_table_lockfree_contains,
+	  (void (*)(void *)) hash_table_lockfree_destroy },
+	{ "cuckoo", false,
+	  (void *(*)(void)) hash_table_cuckoo_create,
+	  (void (*)(void *, const char *, uint32_t)) hash_table_cuckoo_add_entry,
+	  (bool (*)(void *, const char *)) hash_table_cuckoo_contains,
+	  (void (*)(void *)) hash_table_cuckoo_destroy,
+	  NULL,
+	  (bool (*)(void *, const char *)) hash_table_cuckoo_remove },
+};
+
+#define HASH_TABLE_IMPLS (sizeof(hash_table_impls) / sizeof(hash_table_impls[0]))
+#define MAX_STRIPE_COUNTS 16
+
+enum { KEYS_STRING, KEYS_INLINE };
+enum { INSERTS_LOCKED, INSERTS_CAS, INSERTS_COMBINING };
+enum { LAYOUT_SINGLE, LAYOUT_FIRST_TOUCH, LAYOUT_PARTITIONED };
+static const char *const layout_names[] = { "single", "first-touch", "partitioned" };
+static const char *const insert_mode_suffixes[] = { "", "-cas", "-combining" };
 
 struct arguments {
 	uint32_t threads;
 	uint32_t size;
+	bool tables[HASH_TABLE_IMPLS];
+	bool scaling;
+	uint32_t hashes; /* bit i selects hash_functions[i] for --hash */
+	uint32_t batch;
+	bool workload;
+	uint32_t read_percent;
+	uint32_t remove_percent;
+	double zipf_theta;
+	uint32_t key_space;
+	uint32_t working_set;
+	uint32_t ops;
+	uint32_t duration_ms;
+	size_t stripes[MAX_STRIPE_COUNTS];
+	size_t stripe_count;
+	uint32_t locks; /* bit i selects enum hash_table_lock_kind i for the stripe sweep */
+	uint32_t key_layouts; /* bit KEYS_STRING and/or KEYS_INLINE, for the same sweep */
+	uint32_t insert_modes; /* bits for INSERTS_LOCKED, INSERTS_CAS and INSERTS_COMBINING, for the same sweep */
+	bool stats;
+	bool check_removes;
+	const char *key_file;
+	bool bulk;
+	const char *mmap_path;
+	uint32_t affinities; /* bit i selects enum affinity i for the placement sweep */
+	uint32_t layouts;    /* bit LAYOUT_* for the same sweep */
+};
+
+enum {
+	OPT_READS = 256,
+	OPT_REMOVES,
+	OPT_ZIPF,
+	OPT_KEY_SPACE,
+	OPT_WORKING_SET,
+	OPT_OPS,
+	OPT_DURATION,
+	OPT_STRIPES,
+	OPT_LOCK,
+	OPT_KEYS,
+	OPT_INSERTS,
+	OPT_STATS,
+	OPT_KEY_FILE,
+	OPT_BULK,
+	OPT_MMAP,
+	OPT_AFFINITY,
+	OPT_LAYOUT,
+	OPT_CHECK_REMOVES,
 };
 
 static struct argp_option options[] = { 
 	{ "threads", 't', "NUM", 0, "Number of threads."},
 	{ "size", 's', "NUM", 0, "Size per thread."},
+	{ "table", 'T', "NAME", 0, "Also run the named hash table (v1, v2, v2-combining, typed-u64, typed-str, typed-u64/4096, typed-str/4096, v3, grow, lockfree, cuckoo)."},
+	{ "hash", 'H', "NAME", 0, "Time v2 inserts and show bucket lengths with the named hash function (bernstein, fnv1a, murmur64, wyhash or all)."},
+	{ "batch", 'b', "NUM", 0, "Have v2 insert and look up NUM keys per call (0 for one at a time)."},
+	{ "bulk", OPT_BULK, 0, 0, "Have v2 build its table with the lock-free bulk load: each thread partitions its keys by bucket range, then fills one range."},
+	{ "affinity", OPT_AFFINITY, "LIST", 0, "Also run v2 with its threads placed each comma-separated way: none, compact (fill one NUMA node first) or scatter (spread over the nodes), reporting throughput for each."},
+	{ "layout", OPT_LAYOUT, "LIST", 0, "Also run those placements with each comma-separated memory layout: single (one thread touches all the buckets), first-touch (each thread touches its own range) or partitioned (first-touch, then each range is filled only by its owner through the bulk load) (default single)."},
+	{ "mmap", OPT_MMAP, "PATH", 0, "Write the v2 table to PATH, then map it back read-only and look every key up in it."},
+	{ "workload", 'w', 0, 0, "Run a mixed read/write workload against base, v1, v2 and every --table, reporting ops/sec and latency percentiles."},
+	{ "reads", OPT_READS, "PCT", 0, "Percentage of workload operations that are lookups (default 90)."},
+	{ "removes", OPT_REMOVES, "PCT", 0, "Percentage of workload operations that remove their key, churning entries; only tables with a remove run (default 0)."},
+	{ "zipf", OPT_ZIPF, "THETA", 0, "Zipfian key popularity skew in [0, 1), 0 for uniform (default 0)."},
+	{ "key-space", OPT_KEY_SPACE, "NUM", 0, "Keys loaded before the workload starts (default threads * size)."},
+	{ "working-set", OPT_WORKING_SET, "NUM", 0, "Keys the workload touches, out of the key space (default all of it)."},
+	{ "ops", OPT_OPS, "NUM", 0, "Workload operations per thread (default size)."},
+	{ "duration", OPT_DURATION, "MSEC", 0, "Run the workload for MSEC milliseconds instead of a fixed number of operations."},
+	{ "stripes", OPT_STRIPES, "LIST", 0, "Also run v2 with each comma-separated number of lock stripes (default one per bucket)."},
+	{ "lock", OPT_LOCK, "LIST", 0, "Also run v2 with each comma-separated lock kind: mutex, spin or adaptive (default mutex)."},
+	{ "keys", OPT_KEYS, "LIST", 0, "Also run v2 with each comma-separated key layout: string, or inline for keys packed into the node (default string)."},
+	{ "inserts", OPT_INSERTS, "LIST", 0, "Also run v2 with each comma-separated insert mode: locked, cas to push entries onto the chain with a compare-and-swap and no lock, or combining to have the lock holder apply other threads' inserts (default locked)."},
+	{ "key-file", OPT_KEY_FILE, "PATH", 0, "Load the keys, one per line, from PATH instead of generating them; it needs at least threads * size of them."},
+	{ "stats", OPT_STATS, 0, 0, "Count lock contention and print it, with chain lengths, after each v1 and v2 run."},
+	{ "check-removes", OPT_CHECK_REMOVES, 0, 0, "After each --table and --inserts run of a table with a remove, remove every other key, check lookups and a second remove, then add them back."},
+	{ "scaling", 'S', 0, 0, "Time v2 and every thread-safe --table at 1, 2, 4, ... up to --threads threads."},
 	{ 0 } 
 };
 
@@ -73,6 +292,149 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 	case 's':
 		arguments->size = parse_uint32_t(arg);
 		break;
+	case 'T':
+		for (size_t i = 0; i < HASH_TABLE_IMPLS; ++i) {
+			if (strcmp(arg, hash_table_impls[i].name) == 0) {
+				arguments->tables[i] = true;
+				return 0;
+			}
+		}
+		argp_error(state, "unknown hash table '%s'", arg);
+		break;
+	case 'S':
+		arguments->scaling = true;
+		break;
+	case 'b':
+		arguments->batch = parse_uint32_t(arg);
+		break;
+	case 'w':
+		arguments->workload = true;
+		break;
+	case OPT_READS:
+		arguments->read_percent = parse_uint32_t(arg);
+		if (arguments->read_percent > 100) {
+			argp_error(state, "--reads must be at most 100");
+		}
+		break;
+	case OPT_REMOVES:
+		arguments->remove_percent = parse_uint32_t(arg);
+		if (arguments->remove_percent > 100) {
+			argp_error(state, "--removes must be at most 100");
+		}
+		break;
+	case OPT_ZIPF: {
+		char *end;
+		arguments->zipf_theta = strtod(arg, &end);
+		if (*end != 0 || !(arguments->zipf_theta >= 0 && arguments->zipf_theta < 1)) {
+			argp_error(state, "--zipf must be a number in [0, 1)");
+		}
+		break;
+	}
+	case OPT_KEY_SPACE:
+		arguments->key_space = parse_uint32_t(arg);
+		break;
+	case OPT_WORKING_SET:
+		arguments->working_set = parse_uint32_t(arg);
+		break;
+	case OPT_OPS:
+		arguments->ops = parse_uint32_t(arg);
+		break;
+	case OPT_DURATION:
+		arguments->duration_ms = parse_uint32_t(arg);
+		break;
+	case OPT_STRIPES:
+		for (char *item = strtok(arg, ","); item != NULL; item = strtok(NULL, ",")) {
+			if (arguments->stripe_count == MAX_STRIPE_COUNTS) {
+				argp_error(state, "at most %d stripe counts", MAX_STRIPE_COUNTS);
+			}
+			arguments->stripes[arguments->stripe_count++] = parse_uint32_t(item);
+		}
+		break;
+	case OPT_LOCK:
+		for (char *item = strtok(arg, ","); item != NULL; item = strtok(NULL, ",")) {
+			enum hash_table_lock_kind kind;
+			if (!hash_table_lock_kind_parse(item, &kind)) {
+				argp_error(state, "unknown lock kind '%s'", item);
+			}
+			arguments->locks |= 1u << kind;
+		}
+		break;
+	case OPT_KEYS:
+		for (char *item = strtok(arg, ","); item != NULL; item = strtok(NULL, ",")) {
+			if (strcmp(item, "string") == 0) {
+				arguments->key_layouts |= 1u << KEYS_STRING;
+			}
+			else if (strcmp(item, "inline") == 0) {
+				arguments->key_layouts |= 1u << KEYS_INLINE;
+			}
+			else {
+				argp_error(state, "unknown key layout '%s'", item);
+			}
+		}
+		break;
+	case OPT_INSERTS:
+		for (char *item = strtok(arg, ","); item != NULL; item = strtok(NULL, ",")) {
+			if (strcmp(item, "locked") == 0) {
+				arguments->insert_modes |= 1u << INSERTS_LOCKED;
+			}
+			else if (strcmp(item, "cas") == 0) {
+				arguments->insert_modes |= 1u << INSERTS_CAS;
+			}
+			else if (strcmp(item, "combining") == 0) {
+				arguments->insert_modes |= 1u << INSERTS_COMBINING;
+			}
+			else {
+				argp_error(state, "unknown insert mode '%s'", item);
+			}
+		}
+		break;
+	case OPT_AFFINITY:
+		for (char *item = strtok(arg, ","); item != NULL; item = strtok(NULL, ",")) {
+			enum affinity affinity;
+			if (!affinity_parse(item, &affinity)) {
+				argp_error(state, "unknown affinity '%s'", item);
+			}
+			arguments->affinities |= 1u << affinity;
+		}
+		break;
+	case OPT_LAYOUT:
+		for (char *item = strtok(arg, ","); item != NULL; item = strtok(NULL, ",")) {
+			size_t layout = 0;
+			while (layout <= LAYOUT_PARTITIONED && strcmp(item, layout_names[layout]) != 0) {
+				++layout;
+			}
+			if (layout > LAYOUT_PARTITIONED) {
+				argp_error(state, "unknown layout '%s'", item);
+			}
+			arguments->layouts |= 1u << layout;
+		}
+		break;
+	case OPT_MMAP:
+		arguments->mmap_path = arg;
+		break;
+	case OPT_BULK:
+		arguments->bulk = true;
+		break;
+	case OPT_KEY_FILE:
+		arguments->key_file = arg;
+		break;
+	case OPT_STATS:
+		arguments->stats = true;
+		break;
+	case OPT_CHECK_REMOVES:
+		arguments->check_removes = true;
+		break;
+	case 'H':
+		if (strcmp(arg, "all") == 0) {
+			arguments->hashes = (1u << hash_function_count) - 1;
+			break;
+		}
+		const struct hash_function *function = hash_function_find(arg);
+		if (function == NULL) {
+			argp_error(state, "unknown hash function '%s'", arg);
+		}
+		arguments->hashes |= 1u << (function - hash_functions);
+		break;
 	}   
 	return 0;
 }
@@ -85,9 +447,13 @@ static size_t get_global_index(uint32_t thread, uint32_t index)
 	return thread * arguments.size + index;
 }
 
+/* Keys sit key_stride bytes apart: BYTES_PER_STRING for generated keys,
+   or enough for the longest key in a --key-file */
+static size_t key_stride = BYTES_PER_STRING;
+
 static char *get_string(size_t global_index)
 {
-	return data + (global_index * BYTES_PER_STRING);
+	return data + (global_index * key_stride);
 }
 
 static unsigned long usec_diff(struct timeval *a, struct timeval *b)
@@ -112,8 +478,39 @@ void *run_v1(void *arg) {
 
 static struct hash_table_v2 *hash_table_v2;
 
+static struct hash_table_v2_bulk *hash_table_v2_bulk;
+
 void *run_v2(void *arg) {
 	uint32_t thread = (uintptr_t) arg;
+	if (hash_table_v2_bulk != NULL) {
+		const char **keys = calloc(arguments.size, sizeof(char *));
+		uint32_t *values = calloc(arguments.size, sizeof(uint32_t));
+		for (uint32_t j = 0; j < arguments.size; ++j) {
+			size_t global_index = get_global_index(thread, j);
+			keys[j] = get_string(global_index);
+			values[j] = global_index;
+		}
+		hash_table_v2_bulk_add(hash_table_v2_bulk, thread, keys, values, arguments.size);
+		free(values);
+		free(keys);
+		return NULL;
+	}
+	if (arguments.batch > 0) {
+		const char **keys = calloc(arguments.batch, sizeof(char *));
+		uint32_t *values = calloc(arguments.batch, sizeof(uint32_t));
+		for (uint32_t j = 0; j < arguments.size; j += arguments.batch) {
+			uint32_t count = arguments.size - j < arguments.batch ? arguments.size - j : arguments.batch;
+			for (uint32_t k = 0; k < count; ++k) {
+				size_t global_index = get_global_index(thread, j + k);
+				keys[k] = get_string(global_index);
+				values[k] = global_index;
+			}
+			hash_table_v2_add_batch(hash_table_v2, keys, values, count);
+		}
+		free(values);
+		free(keys);
+		return NULL;
+	}
 	for (uint32_t j = 0; j < arguments.size; ++j) {
 		size_t global_index = get_global_index(thread, j);
 		char *string = get_string(global_index);
@@ -122,41 +519,687 @@ void *run_v2(void *arg) {
 	return NULL;
 }
 
+static size_t count_missing_v2_batched(void)
+{
+	size_t missing = 0;
+	size_t key_count = (size_t) arguments.threads * arguments.size;
+	const char **keys = calloc(arguments.batch, sizeof(char *));
+	bool *results = calloc(arguments.batch, sizeof(bool));
+	for (size_t i = 0; i < key_count; i += arguments.batch) {
+		size_t count = key_count - i < arguments.batch ? key_count - i : arguments.batch;
+		for (size_t k = 0; k < count; ++k) {
+			keys[k] = get_string(i + k);
+		}
+		hash_table_v2_contains_batch(hash_table_v2, keys, count, results);
+		for (size_t k = 0; k < count; ++k) {
+			if (!results[k]) {
+				++missing;
+			}
+		}
+	}
+	free(results);
+	free(keys);
+	return missing;
+}
+
+static void print_stats(const struct hash_table_stats *stats)
+{
+	double contended = stats->acquisitions > 0 ? 100.0 * stats->contended / stats->acquisitions : 0;
+	printf("  - locks: %'lu acquired, %'lu contended (%.2f%%), %'lu usec waiting\n",
+	       stats->acquisitions, stats->contended, contended, stats->wait_ns / 1000);
+	printf("  - chains: longest %'zu, lengths", stats->longest_chain);
+	for (size_t i = 0; i < HASH_TABLE_STATS_CHAIN_LENGTHS; ++i) {
+		if (stats->chain_lengths[i] == 0) {
+			continue;
+		}
+		/* Bucket i > 0 holds lengths 2^(i-1) to 2^i - 1, the last one and up */
+		size_t low = i == 0 ? 0 : (size_t) 1 << (i - 1);
+		size_t high = i == 0 ? 0 : ((size_t) 1 << i) - 1;
+		if (i == HASH_TABLE_STATS_CHAIN_LENGTHS - 1) {
+			printf(" %zu+:%'zu", low, stats->chain_lengths[i]);
+		}
+		else if (low == high) {
+			printf(" %zu:%'zu", low, stats->chain_lengths[i]);
+		}
+		else {
+			printf(" %zu-%zu:%'zu", low, high, stats->chain_lengths[i]);
+		}
+	}
+	printf("\n");
+}
+
+static const struct hash_table_impl *impl;
+static void *hash_table_impl;
+
+static void print_impl_stats(void)
+{
+	if (arguments.stats && impl->stats != NULL) {
+		struct hash_table_stats stats;
+		impl->stats(hash_table_impl, &stats);
+		print_stats(&stats);
+	}
+}
+
+void *run_impl(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		size_t global_index = get_global_index(thread, j);
+		char *string = get_string(global_index);
+		impl->add_entry(hash_table_impl, string, global_index);
+	}
+	return NULL;
+}
+
+void *run_impl_lookups(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	uintptr_t missing = 0;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		size_t global_index = get_global_index(thread, j);
+		char *string = get_string(global_index);
+		if (!impl->contains(hash_table_impl, string)) {
+			++missing;
+		}
+	}
+	return (void*) missing;
+}
+
+/* Removes each thread's odd-numbered keys. Returns how many removes
+   succeeded, which should be all of them. */
+void *run_impl_removes(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	uintptr_t removed = 0;
+	for (uint32_t j = 1; j < arguments.size; j += 2) {
+		char *string = get_string(get_global_index(thread, j));
+		if (impl->remove(hash_table_impl, string)) {
+			++removed;
+		}
+	}
+	return (void*) removed;
+}
+
+/* Removes the keys run_impl_removes removed again. Returns how many of
+   these removes succeeded, which should be none. */
+void *run_impl_removes_again(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	uintptr_t wrong = 0;
+	for (uint32_t j = 1; j < arguments.size; j += 2) {
+		char *string = get_string(get_global_index(thread, j));
+		if (impl->remove(hash_table_impl, string)) {
+			++wrong;
+		}
+	}
+	return (void*) wrong;
+}
+
+/* Counts the keys whose presence is wrong after run_impl_removes: the
+   even-numbered ones should still be found and the odd-numbered ones not */
+void *run_impl_removed_lookups(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	uintptr_t wrong = 0;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		char *string = get_string(get_global_index(thread, j));
+		if (impl->contains(hash_table_impl, string) != (j % 2 == 0)) {
+			++wrong;
+		}
+	}
+	return (void*) wrong;
+}
+
+void *run_impl_readds(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	for (uint32_t j = 1; j < arguments.size; j += 2) {
+		size_t global_index = get_global_index(thread, j);
+		impl->add_entry(hash_table_impl, get_string(global_index), global_index);
+	}
+	return NULL;
+}
+
+/* The CPU each thread is pinned to, or NULL to leave them unpinned */
+static const int *thread_cpus;
+
+/* Runs `run` over the keys of the first `thread_count` threads, in parallel
+   unless the table is serial. Adds up what each run returns into *total and
+   returns the elapsed usec. */
+static unsigned long run_impl_threads(void *(*run)(void *),
+                                      pthread_t *threads,
+                                      uint32_t thread_count,
+                                      size_t *total)
+{
+	struct timeval start, end;
+	size_t sum = 0;
+	gettimeofday(&start, NULL);
+	if (impl->serial) {
+		for (uintptr_t i = 0; i < thread_count; ++i) {
+			sum += (uintptr_t) run((void*) i);
+		}
+	}
+	else {
+		for (uintptr_t i = 0; i < thread_count; ++i) {
+			int cpu = thread_cpus != NULL ? thread_cpus[i] : -1;
+			int err = affinity_thread_create(&threads[i], cpu, run, (void*) i);
+			if (err != 0) {
+				printf("pthread_create returned %d\n", err);
+				exit(err);
+			}
+		}
+		for (uintptr_t i = 0; i < thread_count; ++i) {
+			void *result;
+			int err = pthread_join(threads[i], &result);
+			if (err != 0) {
+				printf("pthread_join returned %d\n", err);
+				exit(err);
+			}
+			sum += (uintptr_t) result;
+		}
+	}
+	gettimeofday(&end, NULL);
+	if (total != NULL) {
+		*total = sum;
+	}
+	return usec_diff(&start, &end);
+}
+
+/* With --check-removes, removes every other key from the filled table,
+   counts the removes that succeeded, removes the keys again to check none
+   succeeds, checks lookups, then adds the keys back and
+   checks none is missing */
+static void check_impl_removes(pthread_t *threads)
+{
+	if (!arguments.check_removes || impl->remove == NULL) {
+		return;
+	}
+	size_t removed, wrong_removes, wrong_lookups, missing;
+	run_impl_threads(run_impl_removes, threads, arguments.threads, &removed);
+	run_impl_threads(run_impl_removes_again, threads, arguments.threads, &wrong_removes);
+	run_impl_threads(run_impl_removed_lookups, threads, arguments.threads, &wrong_lookups);
+	run_impl_threads(run_impl_readds, threads, arguments.threads, NULL);
+	run_impl_threads(run_impl_lookups, threads, arguments.threads, &missing);
+	printf("  - removes: %'lu removed, %'lu wrong results, %'lu wrong lookups, %'lu missing after re-adding\n",
+	       removed, wrong_removes, wrong_lookups, missing);
+}
+
+static const struct hash_table_impl *find_impl(const char *name)
+{
+	for (size_t i = 0; i < HASH_TABLE_IMPLS; ++i) {
+		if (strcmp(hash_table_impls[i].name, name) == 0) {
+			return &hash_table_impls[i];
+		}
+	}
+	return NULL;
+}
+
+static int compare_size_t(const void *a, const void *b)
+{
+	size_t x = *(const size_t *) a;
+	size_t y = *(const size_t *) b;
+	return (x > y) - (x < y);
+}
+
+/* Times v2 inserts with the given hash function and prints how evenly it
+   spreads the keys over HASH_TABLE_CAPACITY buckets */
+static void run_hash_function(const struct hash_function *function, pthread_t *threads)
+{
+	hash_table_set_hash_function(function);
+
+	struct timeval start, end;
+	size_t key_count = (size_t) arguments.threads * arguments.size;
+	size_t *lengths = calloc(HASH_TABLE_CAPACITY, sizeof(size_t));
+	gettimeofday(&start, NULL);
+	for (size_t i = 0; i < key_count; ++i) {
+		++lengths[hash_table_hash(get_string(i)) % HASH_TABLE_CAPACITY];
+	}
+	gettimeofday(&end, NULL);
+	unsigned long hash_usec = usec_diff(&start, &end);
+
+	impl = find_impl("v2");
+	hash_table_impl = impl->create();
+	unsigned long insert_usec = run_impl_threads(run_impl, threads, arguments.threads, NULL);
+	impl->destroy(hash_table_impl);
+
+	double mean = (double) key_count / HASH_TABLE_CAPACITY;
+	double variance = 0;
+	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
+		variance += (lengths[i] - mean) * (lengths[i] - mean);
+	}
+	variance /= HASH_TABLE_CAPACITY;
+	qsort(lengths, HASH_TABLE_CAPACITY, sizeof(size_t), compare_size_t);
+
+	printf("Hash %s: %'lu usec v2 inserts, %'lu usec hashing\n",
+	       function->name, insert_usec, hash_usec);
+	printf("  - bucket lengths: min %'zu, median %'zu, p99 %'zu, max %'zu\n",
+	       lengths[0], lengths[HASH_TABLE_CAPACITY / 2],
+	       lengths[HASH_TABLE_CAPACITY * 99 / 100], lengths[HASH_TABLE_CAPACITY - 1]);
+	/* A uniformly random hash would give a standard deviation of about sqrt(mean) */
+	printf("  - stddev %.2f (uniform: %.2f)\n", sqrt(variance), sqrt(mean));
+	free(lengths);
+}
+
+static struct hash_table_v2_config v2_config;
+
+static void *create_v2_configured(void)
+{
+	return hash_table_v2_create_with(&v2_config);
+}
+
+/* Runs v2 with every combination of --lock kind, --stripes count, --keys
+   layout and --inserts mode */
+static void run_v2_configs(pthread_t *threads)
+{
+	size_t default_stripes = HASH_TABLE_CAPACITY;
+	const size_t *stripes = arguments.stripe_count > 0 ? arguments.stripes : &default_stripes;
+	size_t stripe_count = arguments.stripe_count > 0 ? arguments.stripe_count : 1;
+	uint32_t locks = arguments.locks ? arguments.locks : 1u << HASH_TABLE_LOCK_MUTEX;
+	uint32_t key_layouts = arguments.key_layouts ? arguments.key_layouts : 1u << KEYS_STRING;
+	uint32_t insert_modes = arguments.insert_modes ? arguments.insert_modes : 1u << INSERTS_LOCKED;
+
+	static struct hash_table_impl v2_impl;
+	v2_impl = *find_impl("v2");
+	v2_impl.create = create_v2_configured;
+	impl = &v2_impl;
+	for (enum hash_table_lock_kind kind = HASH_TABLE_LOCK_MUTEX; kind <= HASH_TABLE_LOCK_ADAPTIVE; ++kind) {
+		if (!(locks & (1u << kind))) {
+			continue;
+		}
+		for (size_t i = 0; i < stripe_count; ++i) {
+			for (int layout = KEYS_STRING; layout <= KEYS_INLINE; ++layout) {
+				if (!(key_layouts & (1u << layout))) {
+					continue;
+				}
+				for (int mode = INSERTS_LOCKED; mode <= INSERTS_COMBINING; ++mode) {
+					if (!(insert_modes & (1u << mode))) {
+						continue;
+					}
+					v2_config.lock_stripes = stripes[i];
+					v2_config.lock = kind;
+					v2_config.inline_keys = layout == KEYS_INLINE;
+					v2_config.lock_free_inserts = mode == INSERTS_CAS;
+					v2_config.flat_combining = mode == INSERTS_COMBINING;
+					size_t missing;
+					hash_table_impl = impl->create();
+					unsigned long usec = run_impl_threads(run_impl, threads, arguments.threads, NULL);
+					printf("Hash table v2/%zu-%s%s%s: %'lu usec\n", stripes[i], hash_table_lock_kind_name(kind),
+					       layout == KEYS_INLINE ? "-inline" : "", insert_mode_suffixes[mode], usec);
+
+					usec = run_impl_threads(run_impl_lookups, threads, arguments.threads, &missing);
+					printf("  - %'lu missing\n", missing);
+					printf("  - %'lu usec lookups\n", usec);
+					print_impl_stats();
+					check_impl_removes(threads);
+					impl->destroy(hash_table_impl);
+				}
+			}
+		}
+	}
+}
+
+void *run_first_touch(void *arg) {
+	hash_table_v2_first_touch(hash_table_v2, (uintptr_t) arg, arguments.threads);
+	return NULL;
+}
+
+/* Runs v2 with every combination of --affinity and --layout, reporting
+   inserts and lookups per second for each placement */
+static void run_placements(pthread_t *threads)
+{
+	uint32_t affinities = arguments.affinities ? arguments.affinities : 1u << AFFINITY_NONE;
+	uint32_t layouts = arguments.layouts ? arguments.layouts : 1u << LAYOUT_SINGLE;
+	size_t key_count = (size_t) arguments.threads * arguments.size;
+
+	printf("Placements over %d NUMA node%s:\n", affinity_node_count(), affinity_node_count() == 1 ? "" : "s");
+	impl = find_impl("v2");
+	for (enum affinity affinity = AFFINITY_NONE; affinity <= AFFINITY_SCATTER; ++affinity) {
+		if (!(affinities & (1u << affinity))) {
+			continue;
+		}
+		int *cpus = affinity_plan(affinity, arguments.threads);
+		thread_cpus = cpus;
+		for (int layout = LAYOUT_SINGLE; layout <= LAYOUT_PARTITIONED; ++layout) {
+			if (!(layouts & (1u << layout))) {
+				continue;
+			}
+			struct hash_table_v2_config config = {
+				.lock_stripes = HASH_TABLE_CAPACITY,
+				.lock = HASH_TABLE_LOCK_MUTEX,
+				.first_touch = layout != LAYOUT_SINGLE,
+			};
+			hash_table_v2 = hash_table_v2_create_with(&config);
+			hash_table_impl = hash_table_v2;
+			if (config.first_touch) {
+				run_impl_threads(run_first_touch, threads, arguments.threads, NULL);
+			}
+			if (layout == LAYOUT_PARTITIONED) {
+				hash_table_v2_bulk = hash_table_v2_bulk_begin(hash_table_v2, arguments.threads);
+			}
+			unsigned long usec = run_impl_threads(run_v2, threads, arguments.threads, NULL);
+			if (hash_table_v2_bulk != NULL) {
+				hash_table_v2_bulk_end(hash_table_v2_bulk);
+				hash_table_v2_bulk = NULL;
+			}
+			printf("Hash table v2/%s-%s: %'lu usec\n", affinity_name(affinity), layout_names[layout], usec);
+
+			size_t missing;
+			unsigned long lookup_usec = run_impl_threads(run_impl_lookups, threads, arguments.threads, &missing);
+			printf("  - %'lu missing\n", missing);
+			printf("  - %'.0f inserts/sec, %'.0f lookups/sec\n",
+			       key_count * 1e6 / (usec ? usec : 1), key_count * 1e6 / (lookup_usec ? lookup_usec : 1));
+			hash_table_v2_destroy(hash_table_v2);
+		}
+		thread_cpus = NULL;
+		free(cpus);
+	}
+}
+
+static void run_workloads(void)
+{
+	size_t key_count = (size_t) arguments.threads * arguments.size;
+	struct workload workload = {
+		.threads = arguments.threads,
+		.read_percent = arguments.read_percent,
+		.remove_percent = arguments.remove_percent,
+		.zipf_theta = arguments.zipf_theta,
+		.key_space = arguments.key_space ? arguments.key_space : key_count,
+		.ops = arguments.ops ? arguments.ops : arguments.size,
+		.duration_ms = arguments.duration_ms,
+		.keys = data,
+		.key_stride = key_stride,
+	};
+	workload.working_set = arguments.working_set ? arguments.working_set : workload.key_space;
+	if (workload.key_space > key_count || workload.working_set > workload.key_space
+	    || workload.working_set == 0) {
+		fprintf(stderr, "Need 0 < --working-set <= --key-space <= threads * size\n");
+		exit(EINVAL);
+	}
+	if (workload.read_percent + workload.remove_percent > 100) {
+		fprintf(stderr, "Need --reads + --removes <= 100\n");
+		exit(EINVAL);
+	}
+
+	printf("Workload: %u%% reads, ", workload.read_percent);
+	if (workload.remove_percent > 0) {
+		printf("%u%% removes, ", workload.remove_percent);
+	}
+	printf("zipf %.2f, %'zu keys, %'zu working set\n",
+	       workload.zipf_theta, workload.key_space, workload.working_set);
+	for (size_t t = 0; t < HASH_TABLE_IMPLS; ++t) {
+		const char *name = hash_table_impls[t].name;
+		bool always = strcmp(name, "base") == 0 || strcmp(name, "v1") == 0 || strcmp(name, "v2") == 0;
+		if (!always && !arguments.tables[t]) {
+			continue;
+		}
+		if (workload.remove_percent > 0 && hash_table_impls[t].remove == NULL) {
+			continue;
+		}
+		struct workload_result result;
+		workload_run(&workload, &hash_table_impls[t], &result);
+		double ops_per_sec = result.usec > 0 ? result.ops * 1e6 / result.usec : 0;
+		printf("Workload %s: %'.0f ops/sec on %u thread%s, p50 %'lu ns, p99 %'lu ns, p999 %'lu ns\n",
+		       name, ops_per_sec, result.threads, result.threads == 1 ? "" : "s", result.p50_ns, result.p99_ns, result.p999_ns);
+	}
+}
+
+/* The v2 table the mapped file was written from */
+static struct hash_table_v2 *mmap_source;
+
+/* Counts the thread's keys whose mapped value differs from v2's */
+void *run_mmap_values(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	uintptr_t wrong = 0;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		char *string = get_string(get_global_index(thread, j));
+		if (hash_table_mmap_contains(hash_table_impl, string)
+		    && hash_table_mmap_get_value(hash_table_impl, string) != hash_table_v2_get_value(mmap_source, string)) {
+			++wrong;
+		}
+	}
+	return (void*) wrong;
+}
+
+/* Counts keys that are not in the table but are found anyway. Each is one
+   of the thread's keys with a newline appended, which no generated or
+   --key-file key has. */
+void *run_mmap_absent_lookups(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	uintptr_t found = 0;
+	char *absent = malloc(key_stride + 2);
+	if (absent == NULL) {
+		fprintf(stderr, "Failed to allocate memory for a key\n");
+		exit(EXIT_FAILURE);
+	}
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		char *string = get_string(get_global_index(thread, j));
+		size_t length = strlen(string);
+		memcpy(absent, string, length);
+		absent[length] = '\n';
+		absent[length + 1] = 0;
+		if (hash_table_mmap_contains(hash_table_impl, absent)) {
+			++found;
+		}
+	}
+	free(absent);
+	return (void*) found;
+}
+
+/* Dumps v2 to --mmap's file, then times mapping it back and looking up
+   every key straight from the mapping */
+static void run_mmap(struct hash_table_v2 *hash_table, pthread_t *threads)
+{
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+	int err = hash_table_mmap_write_v2(hash_table, arguments.mmap_path);
+	if (err != 0) {
+		fprintf(stderr, "Failed to write %s: %s\n", arguments.mmap_path, strerror(err));
+		exit(err);
+	}
+	gettimeofday(&end, NULL);
+	unsigned long write_usec = usec_diff(&start, &end);
+
+	gettimeofday(&start, NULL);
+	struct hash_table_mmap *hash_table_mmap = hash_table_open_mmap(arguments.mmap_path);
+	if (hash_table_mmap == NULL) {
+		exit(EXIT_FAILURE);
+	}
+	gettimeofday(&end, NULL);
+	unsigned long open_usec = usec_diff(&start, &end);
+
+	static const struct hash_table_impl mmap_impl = {
+		"mmap", false, NULL, NULL,
+		(bool (*)(void *, const char *)) hash_table_mmap_contains,
+		NULL,
+	};
+	impl = &mmap_impl;
+	hash_table_impl = hash_table_mmap;
+	size_t missing;
+	unsigned long usec = run_impl_threads(run_impl_lookups, threads, arguments.threads, &missing);
+	printf("Hash table mmap: %'lu usec\n", write_usec + open_usec);
+	printf("  - %'lu missing\n", missing);
+	printf("  - %'lu usec lookups\n", usec);
+	printf("  - %'lu usec writing %'zu entries, %'lu usec opening\n",
+	       write_usec, hash_table_mmap_size(hash_table_mmap), open_usec);
+
+	size_t wrong_values, absent_found;
+	mmap_source = hash_table;
+	run_impl_threads(run_mmap_values, threads, arguments.threads, &wrong_values);
+	run_impl_threads(run_mmap_absent_lookups, threads, arguments.threads, &absent_found);
+	printf("  - %'lu wrong values, %'lu absent keys found\n", wrong_values, absent_found);
+	hash_table_mmap_close(hash_table_mmap);
+}
+
+/* A stateless mix of the key index, so key i is the same no matter which
+   thread generates it or how many threads there are */
+static uint64_t key_random(uint64_t index)
+{
+	uint64_t z = KEY_SEED + (index + 1) * 0x9e3779b97f4a7c15ull;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+void *run_generate_keys(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	size_t key_count = (size_t) arguments.threads * arguments.size;
+	size_t first = key_count * thread / arguments.threads;
+	size_t last = key_count * (thread + 1) / arguments.threads;
+	for (size_t i = first; i < last; ++i) {
+		char *string = get_string(i);
+		uint64_t r = key_random(i);
+		/* 7 letters use 40 of the 64 random bits */
+		for (uint32_t k = 0; k < (BYTES_PER_STRING - 1); ++k) {
+			int letter = r % 52;
+			r /= 52;
+			if (letter < 26) {
+				string[k] = letter + 0x41;
+			}
+			else {
+				string[k] = letter + 0x47;
+			}
+		}
+		string[BYTES_PER_STRING - 1] = 0;
+	}
+	return NULL;
+}
+
+/* Fills data with threads * size random keys, split across the threads */
+static void generate_keys(pthread_t *threads)
+{
+	data = calloc((size_t) arguments.threads * arguments.size, BYTES_PER_STRING);
+	if (data == NULL) {
+		fprintf(stderr, "Failed to allocate memory for keys\n");
+		exit(EXIT_FAILURE);
+	}
+	for (uintptr_t i = 0; i < arguments.threads; ++i) {
+		int err = pthread_create(&threads[i], NULL, run_generate_keys, (void*) i);
+		if (err != 0) {
+			printf("pthread_create returned %d\n", err);
+			exit(err);
+		}
+	}
+	for (uintptr_t i = 0; i < arguments.threads; ++i) {
+		int err = pthread_join(threads[i], NULL);
+		if (err != 0) {
+			printf("pthread_join returned %d\n", err);
+			exit(err);
+		}
+	}
+}
+
+/* Returns the next non-empty line at or after *cursor and its length,
+   without any '\r' before the newline, and moves *cursor past it */
+static const char *next_line(const char **cursor, const char *end, size_t *length)
+{
+	while (*cursor < end) {
+		const char *line = *cursor;
+		const char *newline = memchr(line, '\n', end - line);
+		const char *line_end = newline != NULL ? newline : end;
+		*cursor = newline != NULL ? newline + 1 : end;
+		if (line_end > line && line_end[-1] == '\r') {
+			--line_end;
+		}
+		if (line_end > line) {
+			*length = line_end - line;
+			return line;
+		}
+	}
+	return NULL;
+}
+
+/* Loads the first threads * size keys of a file with one key per line */
+static void load_keys(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		fprintf(stderr, "Failed to stat %s: %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	if (st.st_size == 0) {
+		fprintf(stderr, "%s has no keys\n", path);
+		exit(EINVAL);
+	}
+	const char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "Failed to map %s: %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+	madvise((void *) map, st.st_size, MADV_SEQUENTIAL);
+	const char *end = map + st.st_size;
+
+	/* Size the slots for the longest key in use before copying any */
+	size_t key_count = (size_t) arguments.threads * arguments.size;
+	size_t found = 0;
+	size_t longest = 0;
+	size_t length;
+	for (const char *cursor = map; found < key_count && next_line(&cursor, end, &length) != NULL; ++found) {
+		if (length > longest) {
+			longest = length;
+		}
+	}
+	if (found < key_count) {
+		fprintf(stderr, "%s has %zu keys, but threads * size is %zu\n", path, found, key_count);
+		exit(EINVAL);
+	}
+	key_stride = (longest + 1 + BYTES_PER_STRING - 1) / BYTES_PER_STRING * BYTES_PER_STRING;
+
+	data = calloc(key_count, key_stride);
+	if (data == NULL) {
+		fprintf(stderr, "Failed to allocate memory for keys\n");
+		exit(EXIT_FAILURE);
+	}
+	const char *cursor = map;
+	for (size_t i = 0; i < key_count; ++i) {
+		const char *line = next_line(&cursor, end, &length);
+		memcpy(get_string(i), line, length);
+	}
+	munmap((void *) map, st.st_size);
+}
+
+/* v2 is the baseline every --scaling run is compared against */
+static bool in_scaling(size_t t)
+{
+	return !hash_table_impls[t].serial
+	       && (arguments.tables[t] || strcmp(hash_table_impls[t].name, "v2") == 0);
+}
+
 int main(int argc, char *argv[])
 {
 	arguments.threads = 4;
 	arguments.size = 25000;
+	arguments.read_percent = 90;
   
 	static struct argp argp = { options, parse_opt };
 	argp_parse(&argp, argc, argv, 0, 0, &arguments);
+	hash_table_stats_enable(arguments.stats);
 
 	setlocale(LC_ALL, "en_US.UTF-8");
 
-	data = calloc(arguments.threads * arguments.size, BYTES_PER_STRING);
-
 	struct timeval start, end;
 
+	pthread_t *threads = calloc(arguments.threads, sizeof(pthread_t));
+
 	gettimeofday(&start, NULL);
-	srand(42);
-	for (uint32_t i = 0; i < arguments.threads; ++i) {
-		for (uint32_t j = 0; j < arguments.size; ++j) {
-			size_t global_index = get_global_index(i, j);
-			char *string = get_string(global_index);
-			for (uint32_t k = 0; k < (BYTES_PER_STRING - 1); ++k) {
-				int r = rand() % 52;
-				if (r < 26) {
-					string[k] = r + 0x41;
-				}
-				else {
-					string[k] = r + 0x47;
-				}
-			}
-			string[BYTES_PER_STRING - 1] = 0;
-		}
+	if (arguments.key_file != NULL) {
+		load_keys(arguments.key_file);
+	}
+	else {
+		generate_keys(threads);
 	}
 	gettimeofday(&end, NULL);
 	printf("Generation: %'lu usec\n", usec_diff(&start, &end));
 
+	/* typed-u64 cannot tell apart keys that only differ past their first word */
+	for (size_t t = 0; t < HASH_TABLE_IMPLS; ++t) {
+		if (arguments.tables[t] && strncmp(hash_table_impls[t].name, "typed-u64", 9) == 0
+		    && key_stride > BYTES_PER_STRING) {
+			fprintf(stderr, "%s needs keys of at most %d bytes, but %s has longer ones\n",
+			        hash_table_impls[t].name, BYTES_PER_STRING - 1, arguments.key_file);
+			exit(EINVAL);
+		}
+	}
+
 	struct hash_table_base *hash_table_base = hash_table_base_create();
 	gettimeofday(&start, NULL);
 	for (uint32_t i = 0; i < arguments.threads; ++i) {
@@ -182,8 +1225,6 @@ int main(int argc, char *argv[])
 	printf("  - %'lu missing\n", missing);
 	hash_table_base_destroy(hash_table_base);
 
-	pthread_t *threads = calloc(arguments.threads, sizeof(pthread_t));
-
 	hash_table_v1 = hash_table_v1_create();
 	gettimeofday(&start, NULL);
 	for (uintptr_t i = 0; i < arguments.threads; ++i) {
@@ -214,10 +1255,18 @@ int main(int argc, char *argv[])
 		}
 	}
 	printf("  - %'lu missing\n", missing);
+	if (arguments.stats) {
+		struct hash_table_stats stats;
+		hash_table_v1_get_stats(hash_table_v1, &stats);
+		print_stats(&stats);
+	}
 	hash_table_v1_destroy(hash_table_v1);
 
 	hash_table_v2 = hash_table_v2_create();
 	gettimeofday(&start, NULL);
+	if (arguments.bulk) {
+		hash_table_v2_bulk = hash_table_v2_bulk_begin(hash_table_v2, arguments.threads);
+	}
 	for (uintptr_t i = 0; i < arguments.threads; ++i) {
 		int err = pthread_create(&threads[i], NULL, run_v2, (void*) i);
 		if (err != 0) {
@@ -232,22 +1281,109 @@ int main(int argc, char *argv[])
 			return err;
 		}
 	}
+	if (hash_table_v2_bulk != NULL) {
+		hash_table_v2_bulk_end(hash_table_v2_bulk);
+		hash_table_v2_bulk = NULL;
+	}
 	gettimeofday(&end, NULL);
 	printf("Hash table v2: %'lu usec\n", usec_diff(&start, &end));
 
 	missing = 0;
-	for (uint32_t i = 0; i < arguments.threads; ++i) {
-		for (uint32_t j = 0; j < arguments.size; ++j) {
-			size_t global_index = get_global_index(i, j);
-			char *string = get_string(global_index);
-			if (!hash_table_v2_contains(hash_table_v2, string)) {
-				++missing;
+	if (arguments.batch > 0) {
+		missing = count_missing_v2_batched();
+	}
+	else {
+		for (uint32_t i = 0; i < arguments.threads; ++i) {
+			for (uint32_t j = 0; j < arguments.size; ++j) {
+				size_t global_index = get_global_index(i, j);
+				char *string = get_string(global_index);
+				if (!hash_table_v2_contains(hash_table_v2, string)) {
+					++missing;
+				}
 			}
 		}
 	}
 	printf("  - %'lu missing\n", missing);
+	if (arguments.stats) {
+		struct hash_table_stats stats;
+		hash_table_v2_get_stats(hash_table_v2, &stats);
+		print_stats(&stats);
+	}
+	if (arguments.mmap_path != NULL) {
+		run_mmap(hash_table_v2, threads);
+	}
 	hash_table_v2_destroy(hash_table_v2);
 
+	for (size_t t = 0; t < HASH_TABLE_IMPLS; ++t) {
+		if (!arguments.tables[t]) {
+			continue;
+		}
+		impl = &hash_table_impls[t];
+		hash_table_impl = impl->create();
+		unsigned long usec = run_impl_threads(run_impl, threads, arguments.threads, NULL);
+		printf("Hash table %s: %'lu usec\n", impl->name, usec);
+
+		usec = run_impl_threads(run_impl_lookups, threads, arguments.threads, &missing);
+		printf("  - %'lu missing\n", missing);
+		printf("  - %'lu usec lookups\n", usec);
+		print_impl_stats();
+		check_impl_removes(threads);
+		impl->destroy(hash_table_impl);
+	}
+
+	if (arguments.stripe_count > 0 || arguments.locks != 0 || arguments.key_layouts != 0
+	    || arguments.insert_modes != 0) {
+		run_v2_configs(threads);
+	}
+
+	if (arguments.affinities != 0 || arguments.layouts != 0) {
+		run_placements(threads);
+	}
+
+	for (size_t i = 0; i < hash_function_count; ++i) {
+		if (arguments.hashes & (1u << i)) {
+			run_hash_function(&hash_functions[i], threads);
+		}
+	}
+	hash_table_set_hash_function(&hash_functions[0]);
+
+	if (arguments.workload) {
+		run_workloads();
+	}
+
+	if (arguments.scaling) {
+		printf("Scaling (usec inserts / usec lookups):\n%8s", "threads");
+		for (size_t t = 0; t < HASH_TABLE_IMPLS; ++t) {
+			if (in_scaling(t)) {
+				printf(" %25s", hash_table_impls[t].name);
+			}
+		}
+		printf("\n");
+		for (uint32_t thread_count = 1; thread_count <= arguments.threads; ) {
+			printf("%8u", thread_count);
+			for (size_t t = 0; t < HASH_TABLE_IMPLS; ++t) {
+				if (!in_scaling(t)) {
+					continue;
+				}
+				impl = &hash_table_impls[t];
+				hash_table_impl = impl->create();
+				unsigned long inserts = run_impl_threads(run_impl, threads, thread_count, NULL);
+				unsigned long lookups = run_impl_threads(run_impl_lookups, threads, thread_count, NULL);
+				printf(" %'12lu / %'10lu", inserts, lookups);
+				fflush(stdout);
+				impl->destroy(hash_table_impl);
+			}
+			printf("\n");
+			/* Always finish with the full --threads count */
+			if (thread_count < arguments.threads && thread_count * 2 > arguments.threads) {
+				thread_count = arguments.threads;
+			}
+			else {
+				thread_count *= 2;
+			}
+		}
+	}
+
 	free(threads);
 	free(data);
 
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "hash-table-arena.h"
+#include "hash-table-common.h"
+#include "hash-table-lock.h"
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* HASH_TABLE_TYPED_DEFINE(name, key_type, value_type, capacity, hash, equal)
+   defines struct name and static inline name_create, name_add_entry,
+   name_contains, name_get_value and name_destroy: a v2-style table (striped
+   mutexes for writers, lock-free chain walks for readers) that is
+   specialized at compile time. Keys are stored by value, so integer and
+   fixed-size keys never go through strlen or strcmp, and hash(key) and
+   equal(a, b), whether functions or macros, are inlined into the chain walk.
+   capacity is the bucket count; a power of two turns the modulo into a mask.
+   Buckets share HASH_TABLE_TYPED_LOCKS(capacity) padded locks, so a large
+   capacity does not need a cache line of lock per bucket.
+   value_type must be a type that _Atomic accepts, such as an integer or a
+   pointer. Pointer keys are stored as given, and must outlive the table. */
+#define HASH_TABLE_TYPED_LOCKS(capacity) \
+    ((capacity) < HASH_TABLE_CAPACITY ? (capacity) : HASH_TABLE_CAPACITY)
+
+#define HASH_TABLE_TYPED_DEFINE(name, key_type, value_type, capacity, hash, equal)        \
+    _Static_assert((capacity) > 0, #name " needs at least one bucket");                 \
+                                                                                         \
+    struct name##_node {                                                                 \
+        key_type key;                                                                    \
+        _Atomic(value_type) value;                                                       \
+        _Atomic(struct name##_node *) next;                                              \
+    };                                                                                   \
+                                                                                         \
+    struct name {                                                                        \
+        _Atomic(struct name##_node *) heads[capacity];                                   \
+        /* taken by writers only; bucket i uses locks[i % HASH_TABLE_TYPED_LOCKS] */    \
+        struct hash_table_lock locks[HASH_TABLE_TYPED_LOCKS(capacity)];                  \
+        struct hash_table_arena *arena;                                                  \
+    };                                                                                   \
+                                                                                         \
+    static inline struct name *name##_create(void) {                                     \
+        struct name *hash_table = aligned_alloc(_Alignof(struct name), sizeof(struct name)); \
+        if (hash_table == NULL) {                                                        \
+            fprintf(stderr, "Failed to allocate memory for hash table\n");               \
+            exit(EXIT_FAILURE);                                                          \
+        }                                                                                \
+        for (size_t i = 0; i < (capacity); ++i) {                                        \
+            atomic_init(&hash_table->heads[i], NULL);                                    \
+        }                                                                                \
+        for (size_t i = 0; i < HASH_TABLE_TYPED_LOCKS(capacity); ++i) {                  \
+            int ret = hash_table_lock_init(&hash_table->locks[i], HASH_TABLE_LOCK_MUTEX); \
+            if (ret != 0) {                                                              \
+                fprintf(stderr, "Error initializing lock: %d\n", ret);                   \
+                exit(ret);                                                               \
+            }                                                                            \
+        }                                                                                \
+        hash_table->arena = hash_table_arena_create();                                   \
+        return hash_table;                                                               \
+    }                                                                                    \
+                                                                                         \
+    static inline void name##_destroy(struct name *hash_table) {                         \
+        for (size_t i = 0; i < HASH_TABLE_TYPED_LOCKS(capacity); ++i) {                  \
+            hash_table_lock_destroy(&hash_table->locks[i]);                              \
+        }                                                                                \
+        hash_table_arena_destroy(hash_table->arena);                                     \
+        free(hash_table);                                                                \
+    }                                                                                    \
+                                                                                         \
+    static inline size_t name##_index(key_type key) {                                    \
+        return (size_t)(hash(key)) % (capacity);                                         \
+    }                                                                                    \
+                                                                                         \
+    static inline struct name##_node *name##_find(struct name *hash_table, size_t index, \
+                                                  key_type key) {                        \
+        struct name##_node *node = atomic_load_explicit(&hash_table->heads[index],       \
+                                                        memory_order_acquire);           \
+        for (; node != NULL; node = atomic_load_explicit(&node->next, memory_order_acquire)) { \
+            if (equal(node->key, key)) {                                                 \
+                return node;                                                             \
+            }                                                                            \
+        }                                                                                \
+        return NULL;                                                                     \
+    }                                                                                    \
+                                                                                         \
+    static inline void name##_add_entry(struct name *hash_table, key_type key,           \
+                                        value_type value) {                              \
+        size_t index = name##_index(key);                                                \
+        struct hash_table_lock *lock = &hash_table->locks[index % HASH_TABLE_TYPED_LOCKS(capacity)]; \
+        int lock_ret = hash_table_lock_acquire(lock);                                    \
+        if (lock_ret != 0) {                                                             \
+            fprintf(stderr, "Error locking bucket: %d\n", lock_ret);                     \
+            exit(lock_ret);                                                              \
+        }                                                                                \
+        struct name##_node *node = name##_find(hash_table, index, key);                  \
+        if (node == NULL) { /* Key not found, create a new node */                       \
+            node = hash_table_arena_alloc(hash_table->arena, sizeof(struct name##_node)); \
+            node->key = key;                                                             \
+            atomic_init(&node->value, value);                                            \
+            atomic_init(&node->next, atomic_load_explicit(&hash_table->heads[index],     \
+                                                          memory_order_relaxed));        \
+            atomic_store_explicit(&hash_table->heads[index], node, memory_order_release); \
+        } else { /* Key found, update the value */                                       \
+            atomic_store_explicit(&node->value, value, memory_order_relaxed);            \
+        }                                                                                \
+        lock_ret = hash_table_lock_release(lock);                                        \
+        if (lock_ret != 0) {                                                             \
+            fprintf(stderr, "Error unlocking bucket: %d\n", lock_ret);                   \
+            exit(lock_ret);                                                              \
+        }                                                                                \
+    }                                                                                    \
+                                                                                         \
+    static inline bool name##_contains(struct name *hash_table, key_type key) {          \
+        return name##_find(hash_table, name##_index(key), key) != NULL;                  \
+    }                                                                                    \
+                                                                                         \
+    static inline value_type name##_get_value(struct name *hash_table, key_type key) {   \
+        struct name##_node *node = name##_find(hash_table, name##_index(key), key);      \
+        assert(node != NULL);                                                            \
+        return atomic_load_explicit(&node->value, memory_order_relaxed);                 \
+    }
+
+/* Ready-made hash and equality functions for the common key types */
+#define HASH_TABLE_TYPED_EQUAL(a, b) ((a) == (b))
+#define HASH_TABLE_TYPED_STRING_EQUAL(a, b) (strcmp((a), (b)) == 0)
+
+/* The murmur3 64-bit finalizer, so integer keys that differ only in their
+   high bits still spread over every bucket */
+static inline uint64_t hash_table_typed_hash_u64(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ull;
+    key ^= key >> 33;
+    return key;
+}
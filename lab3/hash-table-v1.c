@@ -1,53 +1,62 @@
-#include "hash-table-base.h"
+#include "hash-table-v1.h"
+#include "hash-table-arena.h"
+#include "hash-table-lock.h"
+#include "hash-table-stats.h"
 #include <assert.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
-#include <sys/queue.h>
 
+// Entries are only ever pushed onto the head of a chain, and a new entry
+// is fully written before the release store that publishes it. Readers
+// can therefore walk a chain with acquire loads and no lock at all, while
+// writers still serialize on the one lock.
 struct list_entry {
-    const char *key;
-    uint32_t value;
-    SLIST_ENTRY(list_entry) pointers;
+    _Atomic uint32_t value;
+    _Atomic(struct list_entry *) next;
+    char key[]; // stored right after the node, in the same arena allocation
 };
 
-SLIST_HEAD(list_head, list_entry);
-
 struct hash_table_entry {
-    struct list_head list_head;
+    _Atomic(struct list_entry *) head;
 };
 
 struct hash_table_v1 {
     struct hash_table_entry entries[HASH_TABLE_CAPACITY];
-    pthread_mutex_t mutex; // Single mutex for v1
+    struct hash_table_lock lock; // Single mutex for v1
+    struct hash_table_arena *arena; // Holds every list_entry, freed all at once
+    struct hash_table_lock_counters *counters;
 };
 
 // Initialize the mutex for v1
 struct hash_table_v1 *hash_table_v1_create() {
-    struct hash_table_v1 *hash_table = calloc(1, sizeof(struct hash_table_v1));
+    struct hash_table_v1 *hash_table = aligned_alloc(_Alignof(struct hash_table_v1), sizeof(struct hash_table_v1));
     assert(hash_table != NULL);
-    int ret = pthread_mutex_init(&hash_table->mutex, NULL);
+    int ret = hash_table_lock_init(&hash_table->lock, HASH_TABLE_LOCK_MUTEX);
     if (ret != 0) {
         free(hash_table);
         fprintf(stderr, "Error initializing mutex: %d\n", ret);
         exit(ret);
     }
     for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
-        SLIST_INIT(&hash_table->entries[i].list_head);
+        atomic_init(&hash_table->entries[i].head, NULL);
     }
+    hash_table->arena = hash_table_arena_create();
+    hash_table->counters = hash_table_lock_counters_create();
     return hash_table;
 }
 
 static struct hash_table_entry *get_hash_table_entry(struct hash_table_v1 *hash_table, const char *key) {
     assert(key != NULL);
-    uint32_t index = bernstein_hash(key) % HASH_TABLE_CAPACITY;
+    uint32_t index = hash_table_hash(key) % HASH_TABLE_CAPACITY;
     return &hash_table->entries[index];
 }
 
-static struct list_entry *get_list_entry(struct hash_table_v1 *hash_table, const char *key, struct list_head *list_head) {
-    struct list_entry *entry = NULL;
-    SLIST_FOREACH(entry, list_head, pointers) {
+static struct list_entry *get_list_entry(struct hash_table_v1 *hash_table, const char *key, struct hash_table_entry *hash_table_entry) {
+    struct list_entry *entry = atomic_load_explicit(&hash_table_entry->head, memory_order_acquire);
+    for (; entry != NULL; entry = atomic_load_explicit(&entry->next, memory_order_acquire)) {
         if (strcmp(entry->key, key) == 0) {
             return entry;
         }
@@ -56,56 +65,34 @@ static struct list_entry *get_list_entry(struct hash_table_v1 *hash_table, const
 }
 
 bool hash_table_v1_contains(struct hash_table_v1 *hash_table, const char *key) {
-    int lock_ret = pthread_mutex_lock(&hash_table->mutex);
-    if (lock_ret != 0) {
-        fprintf(stderr, "Error locking mutex: %d\n", lock_ret);
-        exit(lock_ret);
-    }
     struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
-    struct list_entry *list_entry = get_list_entry(hash_table, key, &hash_table_entry->list_head);
-    lock_ret = pthread_mutex_unlock(&hash_table->mutex);
-    if (lock_ret != 0) {
-        fprintf(stderr, "Error unlocking mutex: %d\n", lock_ret);
-        exit(lock_ret);
-    }
-    return list_entry != NULL;
+    return get_list_entry(hash_table, key, hash_table_entry) != NULL;
 }
 
 void hash_table_v1_add_entry(struct hash_table_v1 *hash_table, const char *key, uint32_t value) {
-    struct list_entry *new_entry = calloc(1, sizeof(struct list_entry));
-    if (new_entry == NULL) {
-        fprintf(stderr, "Failed to allocate memory for new entry\n");
-        exit(EXIT_FAILURE);
-    }
-    char *dup_key = strdup(key);
-    if (dup_key == NULL) {
-        free(new_entry);
-        fprintf(stderr, "Failed to duplicate key\n");
-        exit(EXIT_FAILURE);
-    }
-
-    int lock_ret = pthread_mutex_lock(&hash_table->mutex);
+    int lock_ret = hash_table_lock_acquire_counted(&hash_table->lock, hash_table->counters);
     if (lock_ret != 0) {
-        free(dup_key);
-        free(new_entry);
         fprintf(stderr, "Error locking mutex: %d\n", lock_ret);
         exit(lock_ret);
     }
 
     struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
-    struct list_entry *list_entry = get_list_entry(hash_table, key, &hash_table_entry->list_head);
+    struct list_entry *list_entry = get_list_entry(hash_table, key, hash_table_entry);
 
     if (list_entry == NULL) {
-        new_entry->key = dup_key;
-        new_entry->value = value;
-        SLIST_INSERT_HEAD(&hash_table_entry->list_head, new_entry, pointers);
+        // Only allocate once the key is known to be new
+        size_t key_size = strlen(key) + 1;
+        struct list_entry *new_entry = hash_table_arena_alloc(hash_table->arena,
+                                                              sizeof(struct list_entry) + key_size);
+        memcpy(new_entry->key, key, key_size);
+        atomic_init(&new_entry->value, value);
+        atomic_init(&new_entry->next, atomic_load_explicit(&hash_table_entry->head, memory_order_relaxed));
+        atomic_store_explicit(&hash_table_entry->head, new_entry, memory_order_release);
     } else {
-        list_entry->value = value;
-        free(dup_key);
-        free(new_entry);
+        atomic_store_explicit(&list_entry->value, value, memory_order_relaxed);
     }
 
-    lock_ret = pthread_mutex_unlock(&hash_table->mutex);
+    lock_ret = hash_table_lock_release(&hash_table->lock);
     if (lock_ret != 0) {
         fprintf(stderr, "Error unlocking mutex: %d\n", lock_ret);
         exit(lock_ret);
@@ -113,40 +100,28 @@ void hash_table_v1_add_entry(struct hash_table_v1 *hash_table, const char *key,
 }
 
 uint32_t hash_table_v1_get_value(struct hash_table_v1 *hash_table, const char *key) {
-    int lock_ret = pthread_mutex_lock(&hash_table->mutex);
-    if (lock_ret != 0) {
-        fprintf(stderr, "Error locking mutex: %d\n", lock_ret);
-        exit(lock_ret);
-    }
-
     struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
-    struct list_entry *list_entry = get_list_entry(hash_table, key, &hash_table_entry->list_head);
-    
-    lock_ret = pthread_mutex_unlock(&hash_table->mutex);
-    if (lock_ret != 0) {
-        fprintf(stderr, "Error unlocking mutex: %d\n", lock_ret);
-        exit(lock_ret);
-    }
-
+    struct list_entry *list_entry = get_list_entry(hash_table, key, hash_table_entry);
     assert(list_entry != NULL);
-    return list_entry->value;
+    return atomic_load_explicit(&list_entry->value, memory_order_relaxed);
 }
 
-void hash_table_v1_destroy(struct hash_table_v1 *hash_table) {
+void hash_table_v1_get_stats(struct hash_table_v1 *hash_table, struct hash_table_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    hash_table_lock_counters_collect(hash_table->counters, stats);
     for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
-        struct list_head *list_head = &hash_table->entries[i].list_head;
-        struct list_entry *entry;
-        while (!SLIST_EMPTY(list_head)) {
-            entry = SLIST_FIRST(list_head);
-            SLIST_REMOVE_HEAD(list_head, pointers);
-            free((void*)entry->key);
-            free(entry);
+        size_t length = 0;
+        struct list_entry *entry = atomic_load_explicit(&hash_table->entries[i].head, memory_order_acquire);
+        for (; entry != NULL; entry = atomic_load_explicit(&entry->next, memory_order_acquire)) {
+            ++length;
         }
+        hash_table_stats_add_chain(stats, length);
     }
+}
 
-    int ret = pthread_mutex_destroy(&hash_table->mutex);
-    if (ret != 0) {
-        fprintf(stderr, "Error destroying mutex: %d\n", ret);
-    }
+void hash_table_v1_destroy(struct hash_table_v1 *hash_table) {
+    hash_table_arena_destroy(hash_table->arena);
+    hash_table_lock_counters_destroy(hash_table->counters);
+    hash_table_lock_destroy(&hash_table->lock);
     free(hash_table);
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "hash-table-common.h"
+#include "hash-table-stats.h"
 
 #include <stdbool.h>
 
@@ -13,4 +14,8 @@ bool hash_table_v1_contains(struct hash_table_v1 *hash_table,
                             const char *key);
 uint32_t hash_table_v1_get_value(struct hash_table_v1 *hash_table,
                                  const char* key);
+/* Lock counts since creation (see hash_table_stats_enable) and a
+   snapshot of the current chain lengths */
+void hash_table_v1_get_stats(struct hash_table_v1 *hash_table,
+                             struct hash_table_stats *stats);
 void hash_table_v1_destroy(struct hash_table_v1 *hash_table);
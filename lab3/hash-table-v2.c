@@ -1,169 +1,804 @@
-#include "hash-table-base.h"
+#include "hash-table-v2.h"
+#include "hash-table-arena.h"
+#include "hash-table-epoch.h"
+#include "hash-table-lock.h"
+#include "hash-table-stats.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <stdalign.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/queue.h>
 
 #include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
 
+// Writers still take the bucket's lock, but entries are only ever pushed
+// onto the head of a chain with a release store once fully written, so
+// contains and get_value walk the chain with acquire loads and no lock.
+// remove unlinks an entry without touching its next pointer, so a reader
+// already on it carries on down the chain. Readers pin an epoch while
+// walking, and a removed entry is only reused once every reader pinned
+// when it was unlinked has finished.
+//
+// With lock_free_inserts, add_entry takes no lock at all: it searches the
+// chain from the head it loaded, then swaps its new entry in over that
+// head. If the head moved, the CAS fails and the insert searches again, so
+// it never misses an equal key added meanwhile. remove still takes the
+// lock, so removes never race each other, and it unlinks a head entry with
+// a CAS too, so a racing prepend is never lost.
+//
+// With flat_combining, a thread that finds its bucket's lock taken posts
+// the insert in a publication slot and waits. The lock holder applies every
+// posted insert for its stripe before releasing, so under a burst on a hot
+// bucket one core does the work while the chain and lock stay in its cache.
 struct list_entry {
-    const char *key;
-    uint32_t value;
-    SLIST_ENTRY(list_entry) pointers;
+    _Atomic uint32_t value;
+    _Atomic(struct list_entry *) next;
+    // Stored right after the node, in the same arena allocation: either the
+    // string, or with inline keys a struct packed_key
+    alignas(uint64_t) char key[];
+};
+
+// Inline keys keep their first 16 bytes, zero padded, as two words. Keys of
+// up to 15 bytes fit with their terminator, so comparing them is two word
+// compares and never a strcmp. Longer keys keep the rest as a string.
+#define PACKED_KEY_BYTES 16
+
+struct packed_key {
+    uint64_t words[PACKED_KEY_BYTES / sizeof(uint64_t)];
+    char tail[]; // only for keys of PACKED_KEY_BYTES or more
 };
 
-SLIST_HEAD(list_head, list_entry);
+// A key being looked up, packed once up front when the table uses inline keys
+struct lookup_key {
+    const char *key;
+    bool fits; // shorter than PACKED_KEY_BYTES
+    struct packed_key packed;
+};
 
 struct hash_table_entry {
-    struct list_head list_head;
-    pthread_mutex_t mutex; // Mutex for each entry in v2
+    _Atomic(struct list_entry *) head;
 };
 
+// Threads share the slots by thread index. A thread that finds its slot
+// busy with another thread's request takes the plain locked path instead.
+#define COMBINING_SLOTS 64
+#define SPINS_BEFORE_YIELD 64
+
+enum { SLOT_FREE, SLOT_CLAIMED, SLOT_PENDING, SLOT_DONE };
+#define SLOT_STATE_BITS 2
+
+// A pending request keeps its lock's index in state, above the SLOT_*
+// value, so a combiner tells from one load whether the request is its to
+// apply. The other fields only change while the slot is claimed.
+struct combining_slot {
+    _Atomic uint64_t state;
+    uint32_t index; // bucket index
+    uint32_t value;
+    const char *key;
+} __attribute__((aligned(64)));
+
+// The locks live apart from the buckets, one per cache line, and bucket i
+// is guarded by locks[i % lock_stripes]. Fewer stripes than buckets keeps
+// the locks in cache at the cost of unrelated buckets sharing a lock.
 struct hash_table_v2 {
     struct hash_table_entry entries[HASH_TABLE_CAPACITY];
+    struct hash_table_lock *locks; // taken by writers only
+    size_t lock_stripes;
+    bool inline_keys;
+    bool lock_free_inserts;
+    bool flat_combining;
+    bool first_touch;                 // the table and locks were mmapped, not malloced
+    enum hash_table_lock_kind lock_kind;
+    struct combining_slot *slots;  // only with flat_combining
+    atomic_uint pending;           // slots in SLOT_PENDING, so a combiner can skip the scan
+    struct hash_table_arena *arena; // Holds every list_entry, freed all at once
+    struct hash_table_lock_counters *counters;
+    struct hash_table_limbo *limbo; // removed entries waiting for readers to move on
 };
 
-// Initialize mutexes for each hash table entry
+static struct packed_key *packed_key(struct list_entry *list_entry) {
+    return (struct packed_key *)list_entry->key;
+}
+
+static void make_lookup_key(struct hash_table_v2 *hash_table, const char *key, struct lookup_key *lookup) {
+    lookup->key = key;
+    if (!hash_table->inline_keys) {
+        return;
+    }
+    size_t length = strnlen(key, PACKED_KEY_BYTES);
+    memset(lookup->packed.words, 0, PACKED_KEY_BYTES);
+    memcpy(lookup->packed.words, key, length);
+    lookup->fits = length < PACKED_KEY_BYTES;
+}
+
+static bool key_matches(struct hash_table_v2 *hash_table, struct list_entry *list_entry,
+                        const struct lookup_key *lookup) {
+    if (!hash_table->inline_keys) {
+        return strcmp(list_entry->key, lookup->key) == 0;
+    }
+    // A short key has its terminator inside the words, so equal words mean
+    // both keys are short or both are long
+    const struct packed_key *packed = packed_key(list_entry);
+    return packed->words[0] == lookup->packed.words[0]
+           && packed->words[1] == lookup->packed.words[1]
+           && (lookup->fits || strcmp(packed->tail, lookup->key + PACKED_KEY_BYTES) == 0);
+}
+
+static size_t list_entry_size(struct hash_table_v2 *hash_table, const char *key) {
+    if (!hash_table->inline_keys) {
+        return sizeof(struct list_entry) + strlen(key) + 1;
+    }
+    size_t length = strlen(key);
+    size_t tail = length < PACKED_KEY_BYTES ? 0 : length - PACKED_KEY_BYTES + 1;
+    return sizeof(struct list_entry) + sizeof(struct packed_key) + tail;
+}
+
+static void write_key(struct hash_table_v2 *hash_table, struct list_entry *list_entry,
+                      const struct lookup_key *lookup) {
+    if (!hash_table->inline_keys) {
+        strcpy(list_entry->key, lookup->key);
+        return;
+    }
+    struct packed_key *packed = packed_key(list_entry);
+    packed->words[0] = lookup->packed.words[0];
+    packed->words[1] = lookup->packed.words[1];
+    if (!lookup->fits) {
+        strcpy(packed->tail, lookup->key + PACKED_KEY_BYTES);
+    }
+}
+
+static void reclaim_list_entry(void *context, void *node) {
+    struct hash_table_v2 *hash_table = context;
+    struct list_entry *list_entry = node;
+    size_t size;
+    if (!hash_table->inline_keys) {
+        size = list_entry_size(hash_table, list_entry->key);
+    } else {
+        struct packed_key *packed = packed_key(list_entry);
+        bool fits = memchr(packed->words, 0, PACKED_KEY_BYTES) != NULL;
+        size = sizeof(struct list_entry) + sizeof(struct packed_key) + (fits ? 0 : strlen(packed->tail) + 1);
+    }
+    hash_table_arena_free(hash_table->arena, list_entry, size);
+}
+
 struct hash_table_v2 *hash_table_v2_create() {
-    struct hash_table_v2 *hash_table = calloc(1, sizeof(struct hash_table_v2));
+    struct hash_table_v2_config config = {
+        .lock_stripes = HASH_TABLE_CAPACITY,
+        .lock = HASH_TABLE_LOCK_MUTEX,
+    };
+    return hash_table_v2_create_with(&config);
+}
+
+// Fresh anonymous pages, which are only placed on a node when first written
+static void *map_untouched(size_t size) {
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return memory == MAP_FAILED ? NULL : memory;
+}
+
+struct hash_table_v2 *hash_table_v2_create_with(const struct hash_table_v2_config *config) {
+    struct hash_table_v2 *hash_table = config->first_touch ? map_untouched(sizeof(struct hash_table_v2))
+                                                           : calloc(1, sizeof(struct hash_table_v2));
     if (hash_table == NULL) {
         fprintf(stderr, "Failed to allocate memory for hash table\n");
         exit(EXIT_FAILURE);
     }
+    hash_table->first_touch = config->first_touch;
+    if (!hash_table->first_touch) {
+        for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
+            atomic_init(&hash_table->entries[i].head, NULL);
+        }
+    }
 
-    for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
-        SLIST_INIT(&hash_table->entries[i].list_head);
-        int ret = pthread_mutex_init(&hash_table->entries[i].mutex, NULL);
+    size_t stripes = config->lock_stripes;
+    if (stripes == 0 || stripes > HASH_TABLE_CAPACITY) {
+        stripes = HASH_TABLE_CAPACITY; // more locks than buckets would never be used
+    }
+    hash_table->lock_stripes = stripes;
+    hash_table->inline_keys = config->inline_keys;
+    hash_table->lock_free_inserts = config->lock_free_inserts;
+    hash_table->flat_combining = config->flat_combining && !config->lock_free_inserts;
+    if (hash_table->flat_combining) {
+        hash_table->slots = aligned_alloc(_Alignof(struct combining_slot),
+                                          COMBINING_SLOTS * sizeof(struct combining_slot));
+        if (hash_table->slots == NULL) {
+            if (hash_table->first_touch) {
+                munmap(hash_table, sizeof(struct hash_table_v2));
+            } else {
+                free(hash_table);
+            }
+            fprintf(stderr, "Failed to allocate memory for combining slots\n");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < COMBINING_SLOTS; ++i) {
+            atomic_init(&hash_table->slots[i].state, SLOT_FREE);
+        }
+    }
+    atomic_init(&hash_table->pending, 0);
+    hash_table->lock_kind = config->lock;
+    hash_table->locks = hash_table->first_touch
+                        ? map_untouched(stripes * sizeof(struct hash_table_lock))
+                        : aligned_alloc(_Alignof(struct hash_table_lock), stripes * sizeof(struct hash_table_lock));
+    if (hash_table->locks == NULL) {
+        fprintf(stderr, "Failed to allocate memory for hash table locks\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < stripes && !hash_table->first_touch; ++i) {
+        int ret = hash_table_lock_init(&hash_table->locks[i], config->lock);
         if (ret != 0) {
             for (size_t j = 0; j < i; ++j) {
-                pthread_mutex_destroy(&hash_table->entries[j].mutex);
+                hash_table_lock_destroy(&hash_table->locks[j]);
             }
+            free(hash_table->locks);
             free(hash_table);
-            fprintf(stderr, "Error initializing mutex: %d\n", ret);
+            fprintf(stderr, "Error initializing lock: %d\n", ret);
             exit(ret);
         }
     }
+    hash_table->arena = hash_table_arena_create();
+    hash_table->counters = hash_table_lock_counters_create();
+    hash_table->limbo = hash_table_limbo_create(reclaim_list_entry, hash_table);
     return hash_table;
 }
 
 void hash_table_v2_destroy(struct hash_table_v2 *hash_table) {
-    for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
-        pthread_mutex_destroy(&hash_table->entries[i].mutex);
-        struct list_head *list_head = &hash_table->entries[i].list_head;
-        struct list_entry *entry;
-        while (!SLIST_EMPTY(list_head)) {
-            entry = SLIST_FIRST(list_head);
-            SLIST_REMOVE_HEAD(list_head, pointers);
-            free((void*)entry->key);
-            free(entry);
+    for (size_t i = 0; i < hash_table->lock_stripes; ++i) {
+        hash_table_lock_destroy(&hash_table->locks[i]);
+    }
+    free(hash_table->slots);
+    hash_table_limbo_destroy(hash_table->limbo);
+    hash_table_arena_destroy(hash_table->arena);
+    hash_table_lock_counters_destroy(hash_table->counters);
+    if (hash_table->first_touch) {
+        munmap(hash_table->locks, hash_table->lock_stripes * sizeof(struct hash_table_lock));
+        munmap(hash_table, sizeof(struct hash_table_v2));
+    } else {
+        free(hash_table->locks);
+        free(hash_table);
+    }
+}
+
+// The first index of part `part` when count items are split into `parts`
+// ranges, matching bulk_partition's split of the buckets
+static size_t range_begin(size_t count, uint32_t part, uint32_t parts) {
+    return ((uint64_t)count * part + parts - 1) / parts;
+}
+
+void hash_table_v2_first_touch(struct hash_table_v2 *hash_table, uint32_t thread, uint32_t threads) {
+    assert(hash_table->first_touch && thread < threads);
+    size_t end = range_begin(HASH_TABLE_CAPACITY, thread + 1, threads);
+    for (size_t i = range_begin(HASH_TABLE_CAPACITY, thread, threads); i < end; ++i) {
+        atomic_init(&hash_table->entries[i].head, NULL);
+    }
+    end = range_begin(hash_table->lock_stripes, thread + 1, threads);
+    for (size_t i = range_begin(hash_table->lock_stripes, thread, threads); i < end; ++i) {
+        int ret = hash_table_lock_init(&hash_table->locks[i], hash_table->lock_kind);
+        if (ret != 0) {
+            fprintf(stderr, "Error initializing lock: %d\n", ret);
+            exit(ret);
         }
     }
-    free(hash_table);
 }
 
 static struct hash_table_entry *get_hash_table_entry(struct hash_table_v2 *hash_table, const char *key) {
     assert(key != NULL);
-    uint32_t index = bernstein_hash(key) % HASH_TABLE_CAPACITY;
+    uint32_t index = hash_table_hash(key) % HASH_TABLE_CAPACITY;
     return &hash_table->entries[index];
 }
 
-static struct list_entry *find_list_entry(struct hash_table_entry *entry, const char *key) {
-    struct list_entry *le = NULL;
-    SLIST_FOREACH(le, &entry->list_head, pointers) {
-        if (strcmp(le->key, key) == 0) {
+static struct list_entry *find_from(struct hash_table_v2 *hash_table, struct list_entry *le,
+                                    const struct lookup_key *lookup) {
+    for (; le != NULL; le = atomic_load_explicit(&le->next, memory_order_acquire)) {
+        if (key_matches(hash_table, le, lookup)) {
             return le;
         }
     }
     return NULL;
 }
 
-void hash_table_v2_add_entry(struct hash_table_v2 *hash_table, const char *key, uint32_t value) {
-    struct hash_table_entry *entry = get_hash_table_entry(hash_table, key);
+static struct list_entry *find_list_entry(struct hash_table_v2 *hash_table, struct hash_table_entry *entry,
+                                          const struct lookup_key *lookup) {
+    return find_from(hash_table, atomic_load_explicit(&entry->head, memory_order_acquire), lookup);
+}
+
+static struct hash_table_lock *get_lock(struct hash_table_v2 *hash_table, struct hash_table_entry *entry) {
+    return &hash_table->locks[(size_t)(entry - hash_table->entries) % hash_table->lock_stripes];
+}
+
+static void lock_stripe(struct hash_table_v2 *hash_table, struct hash_table_lock *lock) {
+    int lock_ret = hash_table_lock_acquire_counted(lock, hash_table->counters);
+    if (lock_ret != 0) {
+        fprintf(stderr, "Error locking stripe: %d\n", lock_ret);
+        hash_table_v2_destroy(hash_table);
+        exit(lock_ret);
+    }
+}
 
-    int lock_ret = pthread_mutex_lock(&entry->mutex);
+static void unlock_stripe(struct hash_table_v2 *hash_table, struct hash_table_lock *lock) {
+    int lock_ret = hash_table_lock_release(lock);
     if (lock_ret != 0) {
-        fprintf(stderr, "Error locking mutex: %d\n", lock_ret);
+        fprintf(stderr, "Error unlocking stripe: %d\n", lock_ret);
         hash_table_v2_destroy(hash_table);
         exit(lock_ret);
     }
+}
 
-    struct list_entry *list_entry = find_list_entry(entry, key);
+// Caller holds the entry's lock, or owns the bucket outright in a bulk load
+static void insert_locked(struct hash_table_v2 *hash_table, struct hash_table_entry *entry,
+                          const char *key, uint32_t value) {
+    struct lookup_key lookup;
+    make_lookup_key(hash_table, key, &lookup);
+    struct list_entry *list_entry = find_list_entry(hash_table, entry, &lookup);
     if (list_entry == NULL) { // Key not found, create a new list entry
-        list_entry = malloc(sizeof(struct list_entry));
-        if (list_entry == NULL) {
-            fprintf(stderr, "Failed to allocate memory for new list entry\n");
-            goto unlock_and_exit;
-        }
-        char *dup_key = strdup(key);
-        if (dup_key == NULL) {
-            free(list_entry);
-            fprintf(stderr, "Failed to duplicate key\n");
-            goto unlock_and_exit;
-        }
-        list_entry->key = dup_key;
-        list_entry->value = value;
-        SLIST_INSERT_HEAD(&entry->list_head, list_entry, pointers);
+        list_entry = hash_table_arena_alloc(hash_table->arena, list_entry_size(hash_table, key));
+        write_key(hash_table, list_entry, &lookup);
+        atomic_init(&list_entry->value, value);
+        atomic_init(&list_entry->next, atomic_load_explicit(&entry->head, memory_order_relaxed));
+        atomic_store_explicit(&entry->head, list_entry, memory_order_release);
     } else { // Key found, update the value
-        list_entry->value = value;
+        atomic_store_explicit(&list_entry->value, value, memory_order_relaxed);
     }
+}
 
-    lock_ret = pthread_mutex_unlock(&entry->mutex);
-    if (lock_ret != 0) {
-        fprintf(stderr, "Error unlocking mutex: %d\n", lock_ret);
-        hash_table_v2_destroy(hash_table);
-        exit(lock_ret);
+// For lock_free_inserts: no lock is held, so the chain can change under us
+static void insert_cas(struct hash_table_v2 *hash_table, struct hash_table_entry *entry,
+                       const char *key, uint32_t value) {
+    struct lookup_key lookup;
+    make_lookup_key(hash_table, key, &lookup);
+    struct list_entry *list_entry = NULL;
+    // Pinned so an entry that a remove unlinks mid-walk is not reused under us
+    hash_table_epoch_enter();
+    struct list_entry *head = atomic_load_explicit(&entry->head, memory_order_acquire);
+    while (true) {
+        struct list_entry *found = find_from(hash_table, head, &lookup);
+        if (found != NULL) { // Key found, update the value
+            atomic_store_explicit(&found->value, value, memory_order_relaxed);
+            break;
+        }
+        if (list_entry == NULL) {
+            list_entry = hash_table_arena_alloc(hash_table->arena, list_entry_size(hash_table, key));
+            write_key(hash_table, list_entry, &lookup);
+            atomic_init(&list_entry->value, value);
+        }
+        atomic_store_explicit(&list_entry->next, head, memory_order_relaxed);
+        // On failure head is reloaded, and the search repeats from it
+        if (atomic_compare_exchange_weak_explicit(&entry->head, &head, list_entry,
+                                                  memory_order_release, memory_order_acquire)) {
+            list_entry = NULL;
+            break;
+        }
     }
-    return;
+    hash_table_epoch_exit();
+    if (list_entry != NULL) { // Lost the race to an equal key
+        hash_table_arena_free(hash_table->arena, list_entry, list_entry_size(hash_table, key));
+    }
+}
 
-unlock_and_exit:
-    pthread_mutex_unlock(&entry->mutex);
-    hash_table_v2_destroy(hash_table);
-    exit(EXIT_FAILURE);
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
 }
 
-bool hash_table_v2_contains(struct hash_table_v2 *hash_table, const char *key) {
-    struct hash_table_entry *entry = get_hash_table_entry(hash_table, key);
-    int lock_ret = pthread_mutex_lock(&entry->mutex);
-    if (lock_ret != 0) {
-        fprintf(stderr, "Error locking mutex: %d\n", lock_ret);
+// Caller holds lock: applies every posted insert for a bucket lock guards
+static void combine(struct hash_table_v2 *hash_table, struct hash_table_lock *lock) {
+    if (atomic_load_explicit(&hash_table->pending, memory_order_acquire) == 0) {
+        return;
+    }
+    uint64_t wanted = (uint64_t)(lock - hash_table->locks) << SLOT_STATE_BITS | SLOT_PENDING;
+    for (size_t i = 0; i < COMBINING_SLOTS; ++i) {
+        struct combining_slot *slot = &hash_table->slots[i];
+        if (atomic_load_explicit(&slot->state, memory_order_acquire) != wanted) {
+            continue;
+        }
+        insert_locked(hash_table, &hash_table->entries[slot->index], slot->key, slot->value);
+        atomic_fetch_sub_explicit(&hash_table->pending, 1, memory_order_relaxed);
+        atomic_store_explicit(&slot->state, SLOT_DONE, memory_order_release);
+    }
+}
+
+static bool try_lock_stripe(struct hash_table_v2 *hash_table, struct hash_table_lock *lock) {
+    int lock_ret = hash_table_lock_try(lock);
+    if (lock_ret != 0 && lock_ret != EBUSY) {
+        fprintf(stderr, "Error locking stripe: %d\n", lock_ret);
         hash_table_v2_destroy(hash_table);
         exit(lock_ret);
     }
+    return lock_ret == 0;
+}
 
-    bool exists = find_list_entry(entry, key) != NULL;
+static void insert_combining(struct hash_table_v2 *hash_table, struct hash_table_entry *entry,
+                             const char *key, uint32_t value) {
+    struct hash_table_lock *lock = get_lock(hash_table, entry);
+    if (try_lock_stripe(hash_table, lock)) {
+        insert_locked(hash_table, entry, key, value);
+        combine(hash_table, lock);
+        unlock_stripe(hash_table, lock);
+        return;
+    }
 
-    lock_ret = pthread_mutex_unlock(&entry->mutex);
-    if (lock_ret != 0) {
-        fprintf(stderr, "Error unlocking mutex: %d\n", lock_ret);
-        hash_table_v2_destroy(hash_table);
-        exit(lock_ret);
+    struct combining_slot *slot = &hash_table->slots[hash_table_thread_index() % COMBINING_SLOTS];
+    uint64_t expected = SLOT_FREE;
+    if (!atomic_compare_exchange_strong_explicit(&slot->state, &expected, SLOT_CLAIMED,
+                                                 memory_order_acquire, memory_order_relaxed)) {
+        lock_stripe(hash_table, lock);
+        insert_locked(hash_table, entry, key, value);
+        combine(hash_table, lock);
+        unlock_stripe(hash_table, lock);
+        return;
     }
+    slot->index = (uint32_t)(entry - hash_table->entries);
+    slot->key = key;
+    slot->value = value;
+    atomic_fetch_add_explicit(&hash_table->pending, 1, memory_order_relaxed);
+    atomic_store_explicit(&slot->state,
+                          (uint64_t)(lock - hash_table->locks) << SLOT_STATE_BITS | SLOT_PENDING,
+                          memory_order_release);
 
-    return exists;
+    // Wait for the lock holder to apply the insert, or become the combiner
+    // ourselves if the lock comes free first
+    unsigned spins = 0;
+    while (atomic_load_explicit(&slot->state, memory_order_acquire) != SLOT_DONE) {
+        if (try_lock_stripe(hash_table, lock)) {
+            combine(hash_table, lock); // applies ours too
+            unlock_stripe(hash_table, lock);
+        } else if (++spins < SPINS_BEFORE_YIELD) {
+            cpu_relax();
+        } else {
+            sched_yield(); // the combiner may not even be running
+        }
+    }
+    atomic_store_explicit(&slot->state, SLOT_FREE, memory_order_release);
 }
 
-uint32_t hash_table_v2_get_value(struct hash_table_v2 *hash_table, const char *key) {
+void hash_table_v2_add_entry(struct hash_table_v2 *hash_table, const char *key, uint32_t value) {
     struct hash_table_entry *entry = get_hash_table_entry(hash_table, key);
-    int lock_ret = pthread_mutex_lock(&entry->mutex);
-    if (lock_ret != 0) {
-        fprintf(stderr, "Error locking mutex: %d\n", lock_ret);
-        hash_table_v2_destroy(hash_table);
-        exit(lock_ret);
+    if (hash_table->lock_free_inserts) {
+        insert_cas(hash_table, entry, key, value);
+        return;
+    }
+    if (hash_table->flat_combining) {
+        insert_combining(hash_table, entry, key, value);
+        return;
     }
+    struct hash_table_lock *lock = get_lock(hash_table, entry);
+    lock_stripe(hash_table, lock);
+    insert_locked(hash_table, entry, key, value);
+    unlock_stripe(hash_table, lock);
+}
 
-    struct list_entry *list_entry = find_list_entry(entry, key);
-    assert(list_entry != NULL);
+// Batches are worked through in chunks small enough to keep on the stack
+#define BATCH_CHUNK 64
+
+struct batch_slot {
+    uint32_t stripe; // lock index
+    uint32_t index;  // bucket index
+    uint32_t offset; // position of the key within the chunk
+};
 
-    uint32_t value = list_entry->value;
+static bool batch_slot_before(const struct batch_slot *a, const struct batch_slot *b) {
+    return a->stripe != b->stripe ? a->stripe < b->stripe : a->index < b->index;
+}
 
-    lock_ret = pthread_mutex_unlock(&entry->mutex);
-    if (lock_ret != 0) {
-        fprintf(stderr, "Error unlocking mutex: %d\n", lock_ret);
-        hash_table_v2_destroy(hash_table);
-        exit(lock_ret);
+// Stable, so repeated keys in a batch are applied in their original order
+static void sort_batch_slots(struct batch_slot *slots, size_t count) {
+    for (size_t i = 1; i < count; ++i) {
+        struct batch_slot slot = slots[i];
+        size_t j = i;
+        while (j > 0 && batch_slot_before(&slot, &slots[j - 1])) {
+            slots[j] = slots[j - 1];
+            --j;
+        }
+        slots[j] = slot;
+    }
+}
+
+void hash_table_v2_add_batch(struct hash_table_v2 *hash_table, const char *const *keys,
+                             const uint32_t *values, size_t count) {
+    if (hash_table->lock_free_inserts) {
+        // There are no locks to share, so just insert in order
+        for (size_t i = 0; i < count; ++i) {
+            hash_table_v2_add_entry(hash_table, keys[i], values[i]);
+        }
+        return;
+    }
+    struct batch_slot slots[BATCH_CHUNK];
+    for (size_t base = 0; base < count; base += BATCH_CHUNK) {
+        size_t chunk = count - base < BATCH_CHUNK ? count - base : BATCH_CHUNK;
+
+        // Hash everything first so the bucket loads overlap instead of
+        // each stalling in turn
+        for (size_t i = 0; i < chunk; ++i) {
+            assert(keys[base + i] != NULL);
+            slots[i].index = hash_table_hash(keys[base + i]) % HASH_TABLE_CAPACITY;
+            slots[i].stripe = slots[i].index % hash_table->lock_stripes;
+            slots[i].offset = i;
+            __builtin_prefetch(&hash_table->entries[slots[i].index], 1);
+        }
+        sort_batch_slots(slots, chunk);
+
+        // Take each lock once for all of the chunk's keys in buckets it guards
+        for (size_t i = 0; i < chunk; ) {
+            uint32_t stripe = slots[i].stripe;
+            struct hash_table_lock *lock = &hash_table->locks[stripe];
+            lock_stripe(hash_table, lock);
+            do {
+                size_t k = base + slots[i].offset;
+                insert_locked(hash_table, &hash_table->entries[slots[i].index], keys[k], values[k]);
+                ++i;
+            } while (i < chunk && slots[i].stripe == stripe);
+            unlock_stripe(hash_table, lock);
+        }
+    }
+}
+
+void hash_table_v2_contains_batch(struct hash_table_v2 *hash_table, const char *const *keys,
+                                  size_t count, bool *results) {
+    struct hash_table_entry *entries[BATCH_CHUNK];
+    for (size_t base = 0; base < count; base += BATCH_CHUNK) {
+        size_t chunk = count - base < BATCH_CHUNK ? count - base : BATCH_CHUNK;
+        for (size_t i = 0; i < chunk; ++i) {
+            entries[i] = get_hash_table_entry(hash_table, keys[base + i]);
+            __builtin_prefetch(entries[i]);
+        }
+        // Reads take no lock, so there is nothing to group; just start the
+        // first node of every chain loading before walking any of them
+        hash_table_epoch_enter();
+        for (size_t i = 0; i < chunk; ++i) {
+            __builtin_prefetch(atomic_load_explicit(&entries[i]->head, memory_order_acquire));
+        }
+        for (size_t i = 0; i < chunk; ++i) {
+            struct lookup_key lookup;
+            make_lookup_key(hash_table, keys[base + i], &lookup);
+            results[base + i] = find_list_entry(hash_table, entries[i], &lookup) != NULL;
+        }
+        hash_table_epoch_exit();
+    }
+}
+
+// A bulk load runs in two phases split by a barrier. First each thread
+// radix-partitions its own keys by bucket range, one partition per thread,
+// into a private buffer. Then thread p inserts partition p from every
+// thread's buffer. No two threads ever touch the same bucket in the second
+// phase, so no locks are taken at all.
+struct bulk_item {
+    const char *key;
+    uint32_t value;
+    uint32_t index; // bucket index
+};
+
+struct bulk_thread {
+    struct bulk_item *items; // grouped by partition
+    size_t *offsets;         // partition p is items[offsets[p]] to items[offsets[p + 1]]
+} __attribute__((aligned(64)));
+
+struct hash_table_v2_bulk {
+    struct hash_table_v2 *hash_table;
+    uint32_t threads;
+    pthread_barrier_t barrier;
+    struct bulk_thread *per_thread;
+};
+
+struct hash_table_v2_bulk *hash_table_v2_bulk_begin(struct hash_table_v2 *hash_table, uint32_t threads) {
+    assert(threads > 0);
+    struct hash_table_v2_bulk *bulk = malloc(sizeof(struct hash_table_v2_bulk));
+    if (bulk == NULL) {
+        fprintf(stderr, "Failed to allocate memory for bulk load\n");
+        exit(EXIT_FAILURE);
+    }
+    bulk->hash_table = hash_table;
+    bulk->threads = threads;
+    bulk->per_thread = aligned_alloc(_Alignof(struct bulk_thread), threads * sizeof(struct bulk_thread));
+    if (bulk->per_thread == NULL) {
+        fprintf(stderr, "Failed to allocate memory for bulk load\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(bulk->per_thread, 0, threads * sizeof(struct bulk_thread));
+    int ret = pthread_barrier_init(&bulk->barrier, NULL, threads);
+    if (ret != 0) {
+        fprintf(stderr, "Error initializing barrier: %d\n", ret);
+        exit(ret);
+    }
+    return bulk;
+}
+
+static uint32_t bulk_partition(struct hash_table_v2_bulk *bulk, uint32_t index) {
+    return (uint64_t)index * bulk->threads / HASH_TABLE_CAPACITY;
+}
+
+static void bulk_wait(struct hash_table_v2_bulk *bulk) {
+    int ret = pthread_barrier_wait(&bulk->barrier);
+    if (ret != 0 && ret != PTHREAD_BARRIER_SERIAL_THREAD) {
+        fprintf(stderr, "Error waiting on barrier: %d\n", ret);
+        exit(ret);
     }
+}
+
+void hash_table_v2_bulk_add(struct hash_table_v2_bulk *bulk, uint32_t thread, const char *const *keys,
+                            const uint32_t *values, size_t count) {
+    assert(thread < bulk->threads);
+    struct hash_table_v2 *hash_table = bulk->hash_table;
+    struct bulk_thread *self = &bulk->per_thread[thread];
+    uint32_t partitions = bulk->threads;
 
+    // Hash every key once and count how many land in each partition
+    uint32_t *indices = malloc(count * sizeof(uint32_t));
+    self->offsets = calloc(partitions + 1, sizeof(size_t));
+    self->items = malloc(count * sizeof(struct bulk_item));
+    if (indices == NULL || self->offsets == NULL || self->items == NULL) {
+        fprintf(stderr, "Failed to allocate memory for bulk load\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        assert(keys[i] != NULL);
+        indices[i] = hash_table_hash(keys[i]) % HASH_TABLE_CAPACITY;
+        ++self->offsets[bulk_partition(bulk, indices[i]) + 1];
+    }
+    for (uint32_t p = 0; p < partitions; ++p) {
+        self->offsets[p + 1] += self->offsets[p];
+    }
+    // Scatter, keeping each partition in the original key order
+    size_t *cursor = malloc(partitions * sizeof(size_t));
+    if (cursor == NULL) {
+        fprintf(stderr, "Failed to allocate memory for bulk load\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(cursor, self->offsets, partitions * sizeof(size_t));
+    for (size_t i = 0; i < count; ++i) {
+        struct bulk_item *item = &self->items[cursor[bulk_partition(bulk, indices[i])]++];
+        item->key = keys[i];
+        item->value = values[i];
+        item->index = indices[i];
+    }
+    free(cursor);
+    free(indices);
+
+    bulk_wait(bulk);
+
+    // This thread alone owns the buckets of partition `thread`. Taking the
+    // other threads' items in thread order makes the last value for a
+    // repeated key the one from the highest thread.
+    for (uint32_t t = 0; t < bulk->threads; ++t) {
+        struct bulk_thread *other = &bulk->per_thread[t];
+        for (size_t i = other->offsets[thread]; i < other->offsets[thread + 1]; ++i) {
+            struct bulk_item *item = &other->items[i];
+            insert_locked(hash_table, &hash_table->entries[item->index], item->key, item->value);
+        }
+    }
+
+    // Nobody may look anything up, or free a buffer, until every range is done
+    bulk_wait(bulk);
+}
+
+void hash_table_v2_bulk_end(struct hash_table_v2_bulk *bulk) {
+    for (uint32_t t = 0; t < bulk->threads; ++t) {
+        free(bulk->per_thread[t].items);
+        free(bulk->per_thread[t].offsets);
+    }
+    pthread_barrier_destroy(&bulk->barrier);
+    free(bulk->per_thread);
+    free(bulk);
+}
+
+bool hash_table_v2_contains(struct hash_table_v2 *hash_table, const char *key) {
+    struct hash_table_entry *entry = get_hash_table_entry(hash_table, key);
+    struct lookup_key lookup;
+    make_lookup_key(hash_table, key, &lookup);
+    hash_table_epoch_enter();
+    bool found = find_list_entry(hash_table, entry, &lookup) != NULL;
+    hash_table_epoch_exit();
+    return found;
+}
+
+uint32_t hash_table_v2_get_value(struct hash_table_v2 *hash_table, const char *key) {
+    struct hash_table_entry *entry = get_hash_table_entry(hash_table, key);
+    struct lookup_key lookup;
+    make_lookup_key(hash_table, key, &lookup);
+    hash_table_epoch_enter();
+    struct list_entry *list_entry = find_list_entry(hash_table, entry, &lookup);
+    assert(list_entry != NULL);
+    uint32_t value = atomic_load_explicit(&list_entry->value, memory_order_relaxed);
+    hash_table_epoch_exit();
     return value;
 }
+
+bool hash_table_v2_remove(struct hash_table_v2 *hash_table, const char *key) {
+    struct hash_table_entry *entry = get_hash_table_entry(hash_table, key);
+    struct hash_table_lock *lock = get_lock(hash_table, entry);
+    struct lookup_key lookup;
+    make_lookup_key(hash_table, key, &lookup);
+    lock_stripe(hash_table, lock);
+    struct list_entry *list_entry;
+    while (true) {
+        _Atomic(struct list_entry *) *link = &entry->head;
+        list_entry = atomic_load_explicit(link, memory_order_acquire);
+        while (list_entry != NULL && !key_matches(hash_table, list_entry, &lookup)) {
+            link = &list_entry->next;
+            list_entry = atomic_load_explicit(link, memory_order_acquire);
+        }
+        if (list_entry == NULL) {
+            break;
+        }
+        struct list_entry *next = atomic_load_explicit(&list_entry->next, memory_order_relaxed);
+        // Lock-free inserts only ever change the head, and the lock keeps
+        // out other removes, so any other link can simply be overwritten.
+        // If an insert pushed a new head since we read it, walk again.
+        if (link != &entry->head || !hash_table->lock_free_inserts) {
+            atomic_store_explicit(link, next, memory_order_release);
+            break;
+        }
+        struct list_entry *expected = list_entry;
+        if (atomic_compare_exchange_strong_explicit(link, &expected, next,
+                                                    memory_order_release, memory_order_relaxed)) {
+            break;
+        }
+    }
+    unlock_stripe(hash_table, lock);
+
+    if (list_entry == NULL) {
+        return false;
+    }
+    hash_table_limbo_retire(hash_table->limbo, list_entry);
+    return true;
+}
+
+void hash_table_v2_for_each(struct hash_table_v2 *hash_table,
+                            void (*visit)(void *context, const char *key, uint32_t value), void *context) {
+    char *long_key = NULL;
+    size_t long_key_size = 0;
+    hash_table_epoch_enter();
+    for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
+        struct list_entry *le = atomic_load_explicit(&hash_table->entries[i].head, memory_order_acquire);
+        for (; le != NULL; le = atomic_load_explicit(&le->next, memory_order_acquire)) {
+            uint32_t value = atomic_load_explicit(&le->value, memory_order_relaxed);
+            if (!hash_table->inline_keys) {
+                visit(context, le->key, value);
+                continue;
+            }
+            // Unpack the key back into a string
+            struct packed_key *packed = packed_key(le);
+            char short_key[PACKED_KEY_BYTES];
+            const char *key = short_key;
+            if (memchr(packed->words, 0, PACKED_KEY_BYTES) != NULL) {
+                memcpy(short_key, packed->words, PACKED_KEY_BYTES);
+            } else {
+                size_t size = PACKED_KEY_BYTES + strlen(packed->tail) + 1;
+                if (size > long_key_size) {
+                    long_key = realloc(long_key, size);
+                    if (long_key == NULL) {
+                        fprintf(stderr, "Failed to allocate memory for key\n");
+                        exit(EXIT_FAILURE);
+                    }
+                    long_key_size = size;
+                }
+                memcpy(long_key, packed->words, PACKED_KEY_BYTES);
+                strcpy(long_key + PACKED_KEY_BYTES, packed->tail);
+                key = long_key;
+            }
+            visit(context, key, value);
+        }
+    }
+    hash_table_epoch_exit();
+    free(long_key);
+}
+
+void hash_table_v2_get_stats(struct hash_table_v2 *hash_table, struct hash_table_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    hash_table_lock_counters_collect(hash_table->counters, stats);
+    hash_table_epoch_enter();
+    for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
+        size_t length = 0;
+        struct list_entry *le = atomic_load_explicit(&hash_table->entries[i].head, memory_order_acquire);
+        for (; le != NULL; le = atomic_load_explicit(&le->next, memory_order_acquire)) {
+            ++length;
+        }
+        hash_table_stats_add_chain(stats, length);
+    }
+    hash_table_epoch_exit();
+}
@@ -1,11 +1,40 @@
 #pragma once
 
 #include "hash-table-common.h"
+#include "hash-table-lock.h"
+#include "hash-table-stats.h"
 
 #include <stdbool.h>
+#include <stddef.h>
 
 struct hash_table_v2;
+
+/* lock_stripes locks are shared round-robin by the HASH_TABLE_CAPACITY
+   buckets; 0 (or anything larger) gives every bucket its own lock.
+   inline_keys packs keys of up to 15 bytes into two words in the node, so
+   a chain walk compares words instead of calling strcmp.
+   lock_free_inserts has add_entry (and add_batch) push new entries with a
+   compare-and-swap on the chain's head instead of taking its lock; only
+   remove still locks.
+   flat_combining has a thread that finds a bucket's lock taken post its
+   add_entry instead of waiting, and whichever thread holds the lock applies
+   every posted insert for that lock's buckets. It has no effect together
+   with lock_free_inserts, which takes no locks to combine under.
+   first_touch leaves the bucket and lock pages untouched on create, for
+   hash_table_v2_first_touch to initialize from the threads that will use
+   them. */
+struct hash_table_v2_config {
+    size_t lock_stripes;
+    enum hash_table_lock_kind lock;
+    bool inline_keys;
+    bool lock_free_inserts;
+    bool flat_combining;
+    bool first_touch;
+};
+
+/* One mutex per bucket, and keys stored as strings */
 struct hash_table_v2 *hash_table_v2_create();
+struct hash_table_v2 *hash_table_v2_create_with(const struct hash_table_v2_config *config);
 void hash_table_v2_add_entry(struct hash_table_v2 *hash_table,
                              const char *key,
                              uint32_t value);
@@ -13,4 +42,50 @@ bool hash_table_v2_contains(struct hash_table_v2 *hash_table,
                             const char *key);
 uint32_t hash_table_v2_get_value(struct hash_table_v2 *hash_table,
                                  const char* key);
+/* Returns whether the key was there. Concurrent lookups stay safe: the
+   entry is only reused once no lookup can still be reading it. */
+bool hash_table_v2_remove(struct hash_table_v2 *hash_table,
+                          const char *key);
+/* Like calling add_entry / contains on each key in turn, but buckets are
+   looked up for the whole batch at once and each lock is taken once per
+   group of keys that share a bucket. */
+void hash_table_v2_add_batch(struct hash_table_v2 *hash_table,
+                             const char *const *keys,
+                             const uint32_t *values,
+                             size_t count);
+void hash_table_v2_contains_batch(struct hash_table_v2 *hash_table,
+                                  const char *const *keys,
+                                  size_t count,
+                                  bool *results);
+/* Builds the table from keys spread over `threads` threads, without taking
+   any lock. Every one of the threads calls bulk_add once with its own keys;
+   the calls return together once all the keys are in. Nothing else may use
+   the table until then. bulk_end frees the scratch space afterwards. */
+struct hash_table_v2_bulk;
+struct hash_table_v2_bulk *hash_table_v2_bulk_begin(struct hash_table_v2 *hash_table,
+                                                    uint32_t threads);
+void hash_table_v2_bulk_add(struct hash_table_v2_bulk *bulk,
+                            uint32_t thread,
+                            const char *const *keys,
+                            const uint32_t *values,
+                            size_t count);
+void hash_table_v2_bulk_end(struct hash_table_v2_bulk *bulk);
+/* For a first_touch table: each of `threads` threads calls this once with
+   its own index, and all must return before the table is used. A thread
+   initializes the same bucket range that it owns in a bulk load, together
+   with those buckets' share of the locks, so with threads pinned to NUMA
+   nodes each range's pages are homed on its owner's node. */
+void hash_table_v2_first_touch(struct hash_table_v2 *hash_table,
+                               uint32_t thread,
+                               uint32_t threads);
+/* Calls visit on every entry, in no particular order. The key string is
+   only valid during the call. Safe alongside other operations, but an
+   entry added or removed meanwhile may or may not be visited. */
+void hash_table_v2_for_each(struct hash_table_v2 *hash_table,
+                            void (*visit)(void *context, const char *key, uint32_t value),
+                            void *context);
+/* Lock counts since creation (see hash_table_stats_enable) and a
+   snapshot of the current chain lengths */
+void hash_table_v2_get_stats(struct hash_table_v2 *hash_table,
+                             struct hash_table_stats *stats);
 void hash_table_v2_destroy(struct hash_table_v2 *hash_table);
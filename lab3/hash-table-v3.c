@@ -0,0 +1,202 @@
+#include "hash-table-v3.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Slots are grouped so one vector compare of the group's tag bytes finds
+// every candidate slot before any key is touched. Build with -mavx2 to
+// get 32-slot groups.
+#if defined(__AVX2__)
+#define GROUP_SIZE 32
+#else
+#define GROUP_SIZE 16
+#endif
+
+#define CACHE_LINE_SIZE 64
+#define TAG_EMPTY 0x80 // full slots store 7 hash bits, so the top bit is clear
+
+struct slot {
+    const char *key;
+    uint32_t hash;
+    uint32_t value;
+};
+
+struct group {
+    uint8_t tags[GROUP_SIZE];
+    struct slot slots[GROUP_SIZE];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct hash_table_v3 {
+    struct group *groups;
+    size_t group_mask; // number of groups - 1, always a power of two minus one
+    unsigned shift;    // 64 - log2(number of groups)
+    size_t size;
+    size_t max_size;   // grow once size passes 7/8 of the slots
+};
+
+// Returns a bit mask with bit i set if tags[i] == tag
+static inline uint32_t match_tag(const uint8_t *tags, uint8_t tag) {
+#if defined(__AVX2__)
+    __m256i group = _mm256_load_si256((const __m256i *)tags);
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi8(group, _mm256_set1_epi8(tag)));
+#elif defined(__SSE2__)
+    __m128i group = _mm_load_si128((const __m128i *)tags);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag)));
+#else
+    uint32_t mask = 0;
+    for (size_t i = 0; i < GROUP_SIZE; ++i) {
+        mask |= (uint32_t)(tags[i] == tag) << i;
+    }
+    return mask;
+#endif
+}
+
+// The default bernstein_hash mixes poorly in its high bits, so spread it
+// over 64 bits before picking the group (high bits) and the tag (the 7 bits
+// below those).
+static inline uint64_t mix_hash(uint32_t hash) {
+    return (uint64_t)hash * 0x9E3779B97F4A7C15ull;
+}
+
+static inline size_t home_group(struct hash_table_v3 *hash_table, uint64_t mixed) {
+    return mixed >> hash_table->shift;
+}
+
+static inline uint8_t hash_tag(struct hash_table_v3 *hash_table, uint64_t mixed) {
+    return (mixed >> (hash_table->shift - 7)) & 0x7F;
+}
+
+static void alloc_groups(struct hash_table_v3 *hash_table, size_t group_count) {
+    hash_table->groups = aligned_alloc(CACHE_LINE_SIZE, group_count * sizeof(struct group));
+    if (hash_table->groups == NULL) {
+        fprintf(stderr, "Failed to allocate memory for hash table groups\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < group_count; ++i) {
+        memset(hash_table->groups[i].tags, TAG_EMPTY, GROUP_SIZE);
+    }
+    hash_table->group_mask = group_count - 1;
+    hash_table->shift = 64 - __builtin_ctzll(group_count);
+    hash_table->max_size = group_count * GROUP_SIZE / 8 * 7;
+}
+
+// Places a key known to be absent in the first group along its probe
+// sequence that still has an empty slot.
+static void insert_slot(struct hash_table_v3 *hash_table, const char *key, uint32_t hash, uint32_t value) {
+    uint64_t mixed = mix_hash(hash);
+    size_t index = home_group(hash_table, mixed);
+    for (size_t step = 1; ; ++step) {
+        struct group *group = &hash_table->groups[index];
+        uint32_t empty = match_tag(group->tags, TAG_EMPTY);
+        if (empty != 0) {
+            size_t i = __builtin_ctz(empty);
+            group->tags[i] = hash_tag(hash_table, mixed);
+            group->slots[i].key = key;
+            group->slots[i].hash = hash;
+            group->slots[i].value = value;
+            ++hash_table->size;
+            return;
+        }
+        index = (index + step) & hash_table->group_mask; // triangular probing visits every group
+    }
+}
+
+static void grow(struct hash_table_v3 *hash_table) {
+    struct group *old_groups = hash_table->groups;
+    size_t old_count = hash_table->group_mask + 1;
+    alloc_groups(hash_table, old_count * 2);
+    hash_table->size = 0;
+    for (size_t g = 0; g < old_count; ++g) {
+        struct group *group = &old_groups[g];
+        uint32_t full = ~match_tag(group->tags, TAG_EMPTY) & (uint32_t)((1ull << GROUP_SIZE) - 1);
+        while (full != 0) {
+            size_t i = __builtin_ctz(full);
+            full &= full - 1;
+            insert_slot(hash_table, group->slots[i].key, group->slots[i].hash, group->slots[i].value);
+        }
+    }
+    free(old_groups);
+}
+
+struct hash_table_v3 *hash_table_v3_create() {
+    struct hash_table_v3 *hash_table = calloc(1, sizeof(struct hash_table_v3));
+    if (hash_table == NULL) {
+        fprintf(stderr, "Failed to allocate memory for hash table\n");
+        exit(EXIT_FAILURE);
+    }
+    alloc_groups(hash_table, HASH_TABLE_CAPACITY / GROUP_SIZE);
+    return hash_table;
+}
+
+static struct slot *find_slot(struct hash_table_v3 *hash_table, const char *key, uint32_t hash) {
+    uint64_t mixed = mix_hash(hash);
+    uint8_t tag = hash_tag(hash_table, mixed);
+    size_t index = home_group(hash_table, mixed);
+    for (size_t step = 1; ; ++step) {
+        struct group *group = &hash_table->groups[index];
+        uint32_t matches = match_tag(group->tags, tag);
+        while (matches != 0) {
+            struct slot *slot = &group->slots[__builtin_ctz(matches)];
+            if (slot->hash == hash && strcmp(slot->key, key) == 0) {
+                return slot;
+            }
+            matches &= matches - 1;
+        }
+        // Nothing is ever removed, so an empty slot ends the probe sequence
+        if (match_tag(group->tags, TAG_EMPTY) != 0) {
+            return NULL;
+        }
+        index = (index + step) & hash_table->group_mask;
+    }
+}
+
+void hash_table_v3_add_entry(struct hash_table_v3 *hash_table, const char *key, uint32_t value) {
+    assert(key != NULL);
+    uint32_t hash = hash_table_hash(key);
+    struct slot *slot = find_slot(hash_table, key, hash);
+    if (slot != NULL) { // Key found, update the value
+        slot->value = value;
+        return;
+    }
+
+    char *dup_key = strdup(key);
+    if (dup_key == NULL) {
+        fprintf(stderr, "Failed to duplicate key\n");
+        exit(EXIT_FAILURE);
+    }
+    if (hash_table->size >= hash_table->max_size) {
+        grow(hash_table);
+    }
+    insert_slot(hash_table, dup_key, hash, value);
+}
+
+bool hash_table_v3_contains(struct hash_table_v3 *hash_table, const char *key) {
+    assert(key != NULL);
+    return find_slot(hash_table, key, hash_table_hash(key)) != NULL;
+}
+
+uint32_t hash_table_v3_get_value(struct hash_table_v3 *hash_table, const char *key) {
+    assert(key != NULL);
+    struct slot *slot = find_slot(hash_table, key, hash_table_hash(key));
+    assert(slot != NULL);
+    return slot->value;
+}
+
+void hash_table_v3_destroy(struct hash_table_v3 *hash_table) {
+    for (size_t g = 0; g <= hash_table->group_mask; ++g) {
+        struct group *group = &hash_table->groups[g];
+        for (size_t i = 0; i < GROUP_SIZE; ++i) {
+            if (group->tags[i] != TAG_EMPTY) {
+                free((void*)group->slots[i].key);
+            }
+        }
+    }
+    free(hash_table->groups);
+    free(hash_table);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "hash-table-common.h"
+
+#include <stdbool.h>
+
+struct hash_table_v3;
+struct hash_table_v3 *hash_table_v3_create();
+void hash_table_v3_add_entry(struct hash_table_v3 *hash_table,
+                             const char *key,
+                             uint32_t value);
+bool hash_table_v3_contains(struct hash_table_v3 *hash_table,
+                            const char *key);
+uint32_t hash_table_v3_get_value(struct hash_table_v3 *hash_table,
+                                 const char* key);
+void hash_table_v3_destroy(struct hash_table_v3 *hash_table);
@@ -0,0 +1,223 @@
+#include "hash-table-workload.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Latencies go into a log-linear histogram: 16 linear sub-buckets per
+   power of two, so every percentile is within 1/16 of the true value. */
+#define SUB_BUCKET_BITS 4
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKETS ((64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS)
+
+struct zipf {
+	size_t n;
+	double theta;
+	double alpha;
+	double zetan;
+	double eta;
+	double half_pow_theta;
+};
+
+struct workload_thread {
+	pthread_t thread;
+	uint32_t index;
+	uint64_t ops;
+	uint64_t histogram[HISTOGRAM_BUCKETS];
+};
+
+static const struct workload *workload;
+static const struct hash_table_impl *impl;
+static void *hash_table;
+static struct zipf zipf;
+static atomic_bool stop;
+
+static size_t histogram_index(uint64_t ns)
+{
+	if (ns < SUB_BUCKETS) {
+		return ns;
+	}
+	unsigned exponent = 63 - __builtin_clzll(ns);
+	return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS
+	       + ((ns >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+}
+
+static uint64_t histogram_value(size_t index)
+{
+	if (index < SUB_BUCKETS) {
+		return index;
+	}
+	unsigned exponent = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+	uint64_t sub = index % SUB_BUCKETS;
+	return (SUB_BUCKETS + sub) << (exponent - SUB_BUCKET_BITS);
+}
+
+static uint64_t histogram_percentile(const uint64_t *histogram, uint64_t total, double percentile)
+{
+	uint64_t target = (uint64_t) ceil(total * percentile);
+	uint64_t seen = 0;
+	for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+		seen += histogram[i];
+		if (seen >= target && seen > 0) {
+			return histogram_value(i);
+		}
+	}
+	return 0;
+}
+
+static uint64_t splitmix64(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+/* Uniform double in [0, 1) */
+static double random_unit(uint64_t *state)
+{
+	return (splitmix64(state) >> 11) * 0x1.0p-53;
+}
+
+/* Gray et al., "Quickly Generating Billion-Record Synthetic Databases" */
+static void zipf_init(struct zipf *z, size_t n, double theta)
+{
+	z->n = n;
+	z->theta = theta;
+	z->zetan = 0;
+	for (size_t i = 1; i <= n; ++i) {
+		z->zetan += 1.0 / pow((double) i, theta);
+	}
+	double zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+	z->alpha = 1.0 / (1.0 - theta);
+	z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+	z->half_pow_theta = 1.0 + pow(0.5, theta);
+}
+
+static size_t zipf_next(const struct zipf *z, uint64_t *state)
+{
+	double u = random_unit(state);
+	double uz = u * z->zetan;
+	if (uz < 1.0) {
+		return 0;
+	}
+	if (uz < z->half_pow_theta) {
+		return 1;
+	}
+	size_t rank = (size_t) (z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+	return rank < z->n ? rank : z->n - 1;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void *run_workload_thread(void *arg)
+{
+	struct workload_thread *self = arg;
+	uint64_t rng = 42 + self->index * 0x9e3779b97f4a7c15ull;
+	for (uint64_t i = 0; ; ++i) {
+		if (workload->duration_ms > 0) {
+			if (atomic_load_explicit(&stop, memory_order_relaxed)) {
+				break;
+			}
+		}
+		else if (i == workload->ops) {
+			break;
+		}
+
+		size_t key_index = workload->zipf_theta > 0
+		                   ? zipf_next(&zipf, &rng)
+		                   : splitmix64(&rng) % workload->working_set;
+		const char *key = workload->keys + key_index * workload->key_stride;
+		uint64_t dice = splitmix64(&rng);
+		uint32_t roll = dice % 100;
+
+		uint64_t start = now_ns();
+		if (roll < workload->read_percent) {
+			impl->contains(hash_table, key);
+		}
+		else if (roll < workload->read_percent + workload->remove_percent) {
+			impl->remove(hash_table, key);
+		}
+		else {
+			impl->add_entry(hash_table, key, (uint32_t) (dice >> 32));
+		}
+		uint64_t end = now_ns();
+
+		++self->histogram[histogram_index(end - start)];
+		++self->ops;
+	}
+	return NULL;
+}
+
+void workload_run(const struct workload *w,
+                  const struct hash_table_impl *table_impl,
+                  struct workload_result *result)
+{
+	workload = w;
+	impl = table_impl;
+	if (w->zipf_theta > 0 && (zipf.n != w->working_set || zipf.theta != w->zipf_theta)) {
+		zipf_init(&zipf, w->working_set, w->zipf_theta);
+	}
+
+	hash_table = impl->create();
+	for (size_t i = 0; i < w->key_space; ++i) {
+		impl->add_entry(hash_table, w->keys + i * w->key_stride, i);
+	}
+
+	uint32_t thread_count = impl->serial ? 1 : w->threads;
+	struct workload_thread *threads = calloc(thread_count, sizeof(struct workload_thread));
+	if (threads == NULL) {
+		fprintf(stderr, "Failed to allocate memory for workload threads\n");
+		exit(EXIT_FAILURE);
+	}
+
+	atomic_store(&stop, false);
+	uint64_t start = now_ns();
+	for (uint32_t i = 0; i < thread_count; ++i) {
+		threads[i].index = i;
+		int err = pthread_create(&threads[i].thread, NULL, run_workload_thread, &threads[i]);
+		if (err != 0) {
+			printf("pthread_create returned %d\n", err);
+			exit(err);
+		}
+	}
+	if (w->duration_ms > 0) {
+		struct timespec duration = { w->duration_ms / 1000, (w->duration_ms % 1000) * 1000000l };
+		nanosleep(&duration, NULL);
+		atomic_store(&stop, true);
+	}
+	for (uint32_t i = 0; i < thread_count; ++i) {
+		int err = pthread_join(threads[i].thread, NULL);
+		if (err != 0) {
+			printf("pthread_join returned %d\n", err);
+			exit(err);
+		}
+	}
+	uint64_t end = now_ns();
+	impl->destroy(hash_table);
+
+	uint64_t *histogram = calloc(HISTOGRAM_BUCKETS, sizeof(uint64_t));
+	memset(result, 0, sizeof(*result));
+	for (uint32_t i = 0; i < thread_count; ++i) {
+		result->ops += threads[i].ops;
+		for (size_t b = 0; b < HISTOGRAM_BUCKETS; ++b) {
+			histogram[b] += threads[i].histogram[b];
+		}
+	}
+	result->threads = thread_count;
+	result->usec = (end - start) / 1000;
+	result->p50_ns = histogram_percentile(histogram, result->ops, 0.50);
+	result->p99_ns = histogram_percentile(histogram, result->ops, 0.99);
+	result->p999_ns = histogram_percentile(histogram, result->ops, 0.999);
+	free(histogram);
+	free(threads);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct hash_table_stats;
+
+/* A table the tester can drive by name, through untyped function pointers */
+struct hash_table_impl {
+	const char *name;
+	bool serial; /* Not thread-safe, so only ever used from one thread */
+	void *(*create)(void);
+	void (*add_entry)(void *hash_table, const char *key, uint32_t value);
+	bool (*contains)(void *hash_table, const char *key);
+	void (*destroy)(void *hash_table);
+	void (*stats)(void *hash_table, struct hash_table_stats *stats); /* NULL if it keeps none */
+	bool (*remove)(void *hash_table, const char *key);               /* NULL if it has none */
+};
+
+/* A mixed read/write benchmark. The first key_space keys are loaded
+   untimed, then each thread runs operations on keys drawn from the first
+   working_set of them, either uniformly or with Zipfian popularity.
+   Removes and re-adds of the same keys churn the table's entries. */
+struct workload {
+	uint32_t threads;
+	uint32_t read_percent;   /* the rest are add_entry updates */
+	uint32_t remove_percent; /* needs impl->remove */
+	double zipf_theta;     /* 0 for uniform, otherwise in (0, 1) */
+	size_t key_space;
+	size_t working_set;
+	uint64_t ops;          /* per thread, used when duration_ms is 0 */
+	uint32_t duration_ms;
+	const char *keys;      /* key i starts at keys + i * key_stride */
+	size_t key_stride;
+};
+
+struct workload_result {
+	uint32_t threads;
+	uint64_t ops;
+	unsigned long usec;
+	uint64_t p50_ns;
+	uint64_t p99_ns;
+	uint64_t p999_ns;
+};
+
+void workload_run(const struct workload *workload,
+                  const struct hash_table_impl *impl,
+                  struct workload_result *result);
@@ -1,5 +1,6 @@
 import re
 import subprocess
+import tempfile
 import unittest
 
 class TestLab3(unittest.TestCase):
@@ -78,3 +79,217 @@ class TestLab3(unittest.TestCase):
         self.assertEqual(miss_1, 0, msg=f"The missing entries for Hash table v1 should be 0 but got {miss_1} instead.")
         self.assertEqual(miss_2, 0, msg=f"The missing entries for Hash table v2 should be 0 but got {miss_2} instead.")
         
+
+    def _table_missing(self, hash_result, name):
+        match = re.search(r'Hash table ' + name + r': ([\d\,]+) usec\n  - ([\d\,]+) missing\n', hash_result)
+        self.assertIsNotNone(match, msg=f"Hash table {name} did not report its results.")
+        return int(match.group(2).replace(",", ""))
+
+    def test_grow(self):
+        print("Running grow tester code...")
+        self.assertTrue(self.make, msg='make failed')
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '8', '-s', '50000', '-T', 'grow')).decode()
+        miss = self._table_missing(hash_result, 'grow')
+
+        self.assertEqual(miss, 0, msg=f"The missing entries for Hash table grow should be 0 but got {miss} instead.")
+
+    def test_v3(self):
+        print("Running v3 tester code...")
+        self.assertTrue(self.make, msg='make failed')
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '8', '-s', '50000', '-T', 'v3')).decode()
+        miss = self._table_missing(hash_result, 'v3')
+
+        self.assertEqual(miss, 0, msg=f"The missing entries for Hash table v3 should be 0 but got {miss} instead.")
+
+    def test_lockfree(self):
+        print("Running lockfree tester code...")
+        self.assertTrue(self.make, msg='make failed')
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '8', '-s', '50000', '-T', 'lockfree')).decode()
+        miss = self._table_missing(hash_result, 'lockfree')
+
+        self.assertEqual(miss, 0, msg=f"The missing entries for Hash table lockfree should be 0 but got {miss} instead.")
+
+    def test_cuckoo(self):
+        print("Running cuckoo tester code...")
+        self.assertTrue(self.make, msg='make failed')
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '8', '-s', '50000', '-T', 'cuckoo')).decode()
+        miss = self._table_missing(hash_result, 'cuckoo')
+
+        self.assertEqual(miss, 0, msg=f"The missing entries for Hash table cuckoo should be 0 but got {miss} instead.")
+
+    def test_typed(self):
+        print("Running typed tester code...")
+        self.assertTrue(self.make, msg='make failed')
+
+        names = ('typed-u64', 'typed-str', 'typed-u64/4096', 'typed-str/4096')
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '8', '-s', '50000') + sum((('-T', name) for name in names), ())).decode()
+        for name in names:
+            miss = self._table_missing(hash_result, name)
+            self.assertEqual(miss, 0, msg=f"The missing entries for Hash table {name} should be 0 but got {miss} instead.")
+
+        # Keys longer than a uint64_t would collapse into one entry, so typed-u64 refuses them
+        with tempfile.TemporaryDirectory() as directory:
+            path = directory + '/keys.txt'
+            with open(path, 'w') as keys:
+                keys.write(''.join(f'customer/{i}\n' for i in range(4000)))
+            result = subprocess.run(('./hash-table-tester', '-t', '4', '-s', '1000', '--key-file', path, '-T', 'typed-u64'), capture_output=True)
+        self.assertNotEqual(result.returncode, 0, msg="typed-u64 should refuse keys longer than 7 bytes.")
+
+    def test_v2_batch(self):
+        print("Running v2 batch tester code...")
+        self.assertTrue(self.make, msg='make failed')
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '8', '-s', '50000', '-b', '48')).decode()
+        match = re.search(r'Hash table v2: ([\d\,]+) usec\n  - ([\d\,]+) missing\n', hash_result)
+        miss = int(match.group(2).replace(",", ""))
+
+        self.assertEqual(miss, 0, msg=f"The missing entries for batched Hash table v2 should be 0 but got {miss} instead.")
+
+    def test_v2_bulk(self):
+        print("Running v2 bulk load tester code...")
+        self.assertTrue(self.make, msg='make failed')
+
+        for threads in ('1', '3', '8'):
+            hash_result = subprocess.check_output(('./hash-table-tester', '-t', threads, '-s', '20000', '--bulk')).decode()
+            miss = self._table_missing(hash_result, 'v2')
+            self.assertEqual(miss, 0, msg=f"The missing entries for bulk loaded Hash table v2 on {threads} threads should be 0 but got {miss} instead.")
+
+    def test_v2_stripes(self):
+        print("Running v2 lock striping tester code...")
+        self.assertTrue(self.make, msg='make failed')
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '8', '-s', '20000', '--stripes', '1,64', '--lock', 'mutex,spin,adaptive')).decode()
+        for name in ('v2/1-mutex', 'v2/64-mutex', 'v2/1-spin', 'v2/64-spin', 'v2/1-adaptive', 'v2/64-adaptive'):
+            miss = self._table_missing(hash_result, name)
+            self.assertEqual(miss, 0, msg=f"The missing entries for Hash table {name} should be 0 but got {miss} instead.")
+
+    def test_v2_inline_keys(self):
+        print("Running v2 inline keys tester code...")
+        self.assertTrue(self.make, msg='make failed')
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '8', '-s', '20000', '--keys', 'string,inline')).decode()
+        for name in ('v2/4096-mutex', 'v2/4096-mutex-inline'):
+            miss = self._table_missing(hash_result, name)
+            self.assertEqual(miss, 0, msg=f"The missing entries for Hash table {name} should be 0 but got {miss} instead.")
+
+    def test_v2_cas_inserts(self):
+        print("Running v2 CAS inserts tester code...")
+        self.assertTrue(self.make, msg='make failed')
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '8', '-s', '20000', '--inserts', 'locked,cas', '--stripes', '64')).decode()
+        for name in ('v2/64-mutex', 'v2/64-mutex-cas'):
+            miss = self._table_missing(hash_result, name)
+            self.assertEqual(miss, 0, msg=f"The missing entries for Hash table {name} should be 0 but got {miss} instead.")
+
+    def test_v2_combining(self):
+        print("Running v2 flat combining tester code...")
+        self.assertTrue(self.make, msg='make failed')
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '8', '-s', '20000', '-T', 'v2-combining', '--inserts', 'combining', '--stripes', '1')).decode()
+        for name in ('v2-combining', 'v2/1-mutex-combining'):
+            miss = self._table_missing(hash_result, name)
+            self.assertEqual(miss, 0, msg=f"The missing entries for Hash table {name} should be 0 but got {miss} instead.")
+
+    def test_placements(self):
+        print("Running placement tester code...")
+        self.assertTrue(self.make, msg='make failed')
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '4', '-s', '20000', '--affinity', 'none,compact,scatter', '--layout', 'single,first-touch,partitioned')).decode()
+        for affinity in ('none', 'compact', 'scatter'):
+            for layout in ('single', 'first-touch', 'partitioned'):
+                name = f'v2/{affinity}-{layout}'
+                miss = self._table_missing(hash_result, name)
+                self.assertEqual(miss, 0, msg=f"The missing entries for Hash table {name} should be 0 but got {miss} instead.")
+
+    def test_generation_deterministic(self):
+        print("Running deterministic generation tester code...")
+        self.assertTrue(self.make, msg='make failed')
+
+        # The same keys hash to the same buckets however many threads make them
+        lengths = set()
+        for threads, size in (('1', '40000'), ('4', '10000'), ('8', '5000')):
+            hash_result = subprocess.check_output(('./hash-table-tester', '-t', threads, '-s', size, '-H', 'bernstein')).decode()
+            match = re.search(r'  - bucket lengths: (.*)\n', hash_result)
+            self.assertIsNotNone(match, msg="Hash bernstein did not report its bucket lengths.")
+            lengths.add(match.group(1))
+        self.assertEqual(len(lengths), 1, msg=f"Generated keys differ between thread counts: {lengths}")
+
+    def test_key_file(self):
+        print("Running key file tester code...")
+        self.assertTrue(self.make, msg='make failed')
+
+        with tempfile.NamedTemporaryFile('w', suffix='.txt') as key_file:
+            for i in range(40000):
+                key_file.write(f'customer/{i * 7919 % 100003}/cart/{"x" * (i % 23)}\n')
+            key_file.flush()
+            hash_result = subprocess.check_output(('./hash-table-tester', '-t', '4', '-s', '10000', '--key-file', key_file.name)).decode()
+        for name in ('base', 'v1', 'v2'):
+            miss = self._table_missing(hash_result, name)
+            self.assertEqual(miss, 0, msg=f"The missing entries for Hash table {name} should be 0 but got {miss} instead.")
+
+    def test_mmap(self):
+        print("Running mmap tester code...")
+        self.assertTrue(self.make, msg='make failed')
+
+        with tempfile.TemporaryDirectory() as directory:
+            path = directory + '/v2.htbl'
+            hash_result = subprocess.check_output(('./hash-table-tester', '-t', '4', '-s', '20000', '--mmap', path)).decode()
+        miss = self._table_missing(hash_result, 'mmap')
+        self.assertEqual(miss, 0, msg=f"The missing entries for Hash table mmap should be 0 but got {miss} instead.")
+
+        match = re.search(r'  - ([\d\,]+) wrong values, ([\d\,]+) absent keys found\n', hash_result)
+        self.assertIsNotNone(match, msg="Hash table mmap did not report its value and absent key checks.")
+        wrong_values, absent_found = (int(match.group(i).replace(",", "")) for i in (1, 2))
+        self.assertEqual(wrong_values, 0, msg=f"Hash table mmap returned {wrong_values} values that differ from v2's.")
+        self.assertEqual(absent_found, 0, msg=f"Hash table mmap found {absent_found} keys that it does not hold.")
+
+    def test_stats(self):
+        print("Running lock statistics tester code...")
+        self.assertTrue(self.make, msg='make failed')
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '4', '-s', '20000', '--stats')).decode()
+        for name in ('v1', 'v2'):
+            match = re.search(r'Hash table ' + name + r': [\d\,]+ usec\n  - [\d\,]+ missing\n  - locks: ([\d\,]+) acquired, ([\d\,]+) contended \([\d\.]+%\), [\d\,]+ usec waiting\n  - chains: longest ([\d\,]+), lengths((?: [\d\-\+]+:[\d\,]+)+)\n', hash_result)
+            self.assertIsNotNone(match, msg=f"Hash table {name} did not report its statistics.")
+            acquired, contended, longest = (int(match.group(i).replace(",", "")) for i in (1, 2, 3))
+            chains = sum(int(count.replace(",", "")) for count in re.findall(r':([\d\,]+)', match.group(4)))
+
+            self.assertEqual(acquired, 80000, msg=f"Hash table {name} should take its lock once per insert but took it {acquired} times.")
+            self.assertLessEqual(contended, acquired, msg=f"Hash table {name} reported more contended acquisitions than acquisitions.")
+            self.assertEqual(chains, 4096, msg=f"The chain length histogram for Hash table {name} should cover all 4096 buckets but covers {chains}.")
+            self.assertGreater(longest, 0, msg=f"The longest chain for Hash table {name} should not be empty.")
+
+    def test_workload(self):
+        print("Running workload tester code...")
+        self.assertTrue(self.make, msg='make failed')
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '4', '-s', '20000', '-w', '--zipf', '0.99', '--reads', '80', '--working-set', '5000')).decode()
+        for name in ('base', 'v1', 'v2'):
+            match = re.search(r'Workload ' + name + r': ([\d\,]+) ops/sec on \d+ threads?, p50 ([\d\,]+) ns, p99 ([\d\,]+) ns, p999 ([\d\,]+) ns\n', hash_result)
+            self.assertIsNotNone(match, msg=f"The workload for Hash table {name} did not report its results.")
+            p50, p99, p999 = (int(match.group(i).replace(",", "")) for i in (2, 3, 4))
+            self.assertTrue(p50 <= p99 <= p999, msg=f"The latency percentiles for Hash table {name} are out of order.")
+
+    def test_churn(self):
+        print("Running churn workload tester code...")
+        self.assertTrue(self.make, msg='make failed')
+
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '4', '-s', '20000', '-w', '--reads', '50', '--removes', '25', '--working-set', '2000')).decode()
+        match = re.search(r'Workload v2: ([\d\,]+) ops/sec on \d+ threads?, p50 ([\d\,]+) ns, p99 ([\d\,]+) ns, p999 ([\d\,]+) ns\n', hash_result)
+        self.assertIsNotNone(match, msg="The churn workload for Hash table v2 did not report its results.")
+        self.assertIsNone(re.search(r'Workload base:', hash_result), msg="Hash table base has no remove, so it should not run a churn workload.")
+
+        # Every other key removed, checked, and added back, on v2 in each insert mode and on cuckoo
+        hash_result = subprocess.check_output(('./hash-table-tester', '-t', '4', '-s', '20000', '-T', 'cuckoo', '--inserts', 'locked,cas,combining', '--check-removes')).decode()
+        for name in ('v2/4096-mutex', 'v2/4096-mutex-cas', 'v2/4096-mutex-combining', 'cuckoo'):
+            match = re.search(r'Hash table ' + re.escape(name) + r': [\d\,]+ usec\n(?:  - .*\n)*?  - removes: ([\d\,]+) removed, ([\d\,]+) wrong results, ([\d\,]+) wrong lookups, ([\d\,]+) missing after re-adding\n', hash_result)
+            self.assertIsNotNone(match, msg=f"Hash table {name} did not report its remove check.")
+            removed, wrong_results, wrong_lookups, missing = (int(match.group(i).replace(",", "")) for i in (1, 2, 3, 4))
+            self.assertEqual(removed, 40000, msg=f"Hash table {name} should have removed every other key.")
+            self.assertEqual(wrong_results, 0, msg=f"Hash table {name} removed {wrong_results} keys a second time.")
+            self.assertEqual(wrong_lookups, 0, msg=f"Hash table {name} found {wrong_lookups} keys it should not have, or missed ones it should have, after removes.")
+            self.assertEqual(missing, 0, msg=f"Hash table {name} is missing {missing} keys after adding the removed ones back.")